@@ -0,0 +1,1455 @@
+#ifndef BTREE_INTERVAL_TREE_H
+#define BTREE_INTERVAL_TREE_H
+
+#include <cstdint>
+
+#include <interval_tree.h>
+
+// Same container as interval_tree, laid out as a B+-tree. The elements are
+// kept in key order in leaves of up to leaf_slots elements, linked to each
+// other. An internal node holds up to inner_slots children along with the
+// first lower bound and the max upper bound of each of them, and fits in two
+// cache lines. Ties on the lower bound are broken with the first key of the
+// child itself.
+// Inserting and erasing move elements between slots: iterators, references
+// and pointers to elements are invalidated by any modification.
+template<
+    typename Key,
+    typename T,
+    typename Compare = std::less<Key>,
+    typename Allocator = std::allocator<std::pair<std::pair<Key, Key>, T>>,
+    typename std::enable_if<std::is_default_constructible<Key>::value, int>::type = 0
+>
+class btree_interval_tree
+{
+public:
+    // ====== TYPEDEFS =========================================================
+    typedef Key                                    bound_type;
+    typedef std::pair<Key, Key>                    key_type;
+    typedef T                                      mapped_type;
+
+    typedef std::size_t                            size_type;
+    typedef std::ptrdiff_t                         difference_type;
+    typedef std::pair<key_type, mapped_type>       value_type;
+    typedef value_type*                            pointer;
+    typedef const value_type*                      const_pointer;
+    typedef value_type&                            reference;
+    typedef const value_type&                      const_reference;
+    typedef Allocator                              allocator_type;
+
+    // A whole internal node, its header and a lower bound, a max and a
+    // pointer per child, takes two cache lines, a leaf about eight
+    static constexpr size_type inner_slots = std::max<size_type>((128 - 2 * sizeof(void*)) / (2 * sizeof(bound_type) + sizeof(void*)), 4);
+    static constexpr size_type leaf_slots  = std::clamp<size_type>(512 / sizeof(value_type), 8, 64);
+
+
+
+private:
+    // ====== NODES ============================================================
+    // Below these counts a node takes elements or children from a sibling,
+    // or is merged with it. Only the last node of each level may hold less,
+    // appending in key order splits it unevenly.
+    static constexpr size_type inner_min = inner_slots / 2;
+    static constexpr size_type leaf_min  = leaf_slots / 2;
+
+    struct inner;
+
+    struct node_base
+    {
+        explicit node_base(bool is_leaf) : is_leaf(is_leaf) {}
+
+        inner*        parent = nullptr;
+        std::uint16_t pos    = 0;    // index in parent
+        std::uint16_t count  = 0;
+        bool          is_leaf;
+    };
+
+    struct leaf : node_base
+    {
+        // data is left uninitialized here, the first count elements are
+        // constructed and destroyed through the allocator
+        leaf() : node_base(true) {}
+        ~leaf() {}
+
+        leaf* prev = nullptr;
+        leaf* next = nullptr;
+
+        union { value_type data[leaf_slots]; };
+    };
+
+    struct alignas(64) inner : node_base
+    {
+        inner() : node_base(false) {}
+
+        bound_type maxs[inner_slots];      // max upper bound of each child
+        bound_type lowers[inner_slots];    // first lower bound of each child
+        node_base* children[inner_slots];
+    };
+
+public:
+    // ====== KEY COMPARE ======================================================
+    typedef interval_comparator<Key, T, Compare> comparator;
+
+    typedef comparator key_compare;
+    typedef comparator value_compare;
+
+
+
+    // ====== ITERATOR =========================================================
+    class iterator
+    {
+        friend class btree_interval_tree;
+
+    public:
+        typedef btree_interval_tree::difference_type  difference_type;
+        typedef btree_interval_tree::value_type       value_type;
+        typedef btree_interval_tree::pointer          pointer;
+        typedef btree_interval_tree::const_pointer    const_pointer;
+        typedef btree_interval_tree::reference        reference;
+        typedef btree_interval_tree::const_reference  const_reference;
+        typedef std::bidirectional_iterator_tag       iterator_category;
+
+    protected:
+        iterator(const btree_interval_tree* t, leaf* l = nullptr, size_type i = 0) : tree(t), l(l), i(i) {}
+
+    public:
+        iterator() = default;
+
+        inline void swap(iterator& other) noexcept
+        {
+            std::swap(tree, other.tree);
+            std::swap(l, other.l);
+            std::swap(i, other.i);
+        }
+
+        inline bool operator==(const iterator& other) const { return l == other.l && i == other.i; }
+        inline bool operator!=(const iterator& other) const { return !(*this == other); }
+
+        inline reference operator*()  { return l->data[i];  }
+        inline pointer   operator->() { return &l->data[i]; }
+
+        inline const_reference operator*()  const { return l->data[i];  }
+        inline const_pointer   operator->() const { return &l->data[i]; }
+
+        inline iterator& operator++()
+        {
+            tree->next(l, i);
+            return *this;
+        }
+
+        inline iterator  operator++(int)
+        {
+            iterator it(*this);
+            ++*this;
+            return it;
+        }
+
+        inline iterator& operator--()
+        {
+            tree->prev(l, i);
+            return *this;
+        }
+
+        inline iterator  operator--(int)
+        {
+            iterator it(*this);
+            --*this;
+            return it;
+        }
+
+    protected:
+        const btree_interval_tree* tree = nullptr;
+        leaf*                      l    = nullptr;
+        size_type                  i    = 0;
+    };
+
+
+
+    class const_iterator
+    {
+        friend class btree_interval_tree;
+
+    public:
+        typedef btree_interval_tree::difference_type  difference_type;
+        typedef btree_interval_tree::value_type       value_type;
+        typedef btree_interval_tree::const_pointer    pointer;
+        typedef btree_interval_tree::const_pointer    const_pointer;
+        typedef btree_interval_tree::const_reference  reference;
+        typedef btree_interval_tree::const_reference  const_reference;
+        typedef std::bidirectional_iterator_tag       iterator_category;
+
+    protected:
+        const_iterator(const btree_interval_tree* t, leaf* l = nullptr, size_type i = 0) : tree(t), l(l), i(i) {}
+
+    public:
+        const_iterator() = default;
+        const_iterator(const iterator& copy) : tree(copy.tree), l(copy.l), i(copy.i) {}
+
+        inline void swap(const_iterator& other) noexcept
+        {
+            std::swap(tree, other.tree);
+            std::swap(l, other.l);
+            std::swap(i, other.i);
+        }
+
+        inline bool operator==(const const_iterator& other) const { return l == other.l && i == other.i; }
+        inline bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+        inline reference operator*()  const { return l->data[i];  }
+        inline pointer   operator->() const { return &l->data[i]; }
+
+        inline const_iterator& operator++()
+        {
+            tree->next(l, i);
+            return *this;
+        }
+
+        inline const_iterator operator++(int)
+        {
+            const_iterator it(*this);
+            ++*this;
+            return it;
+        }
+
+        inline const_iterator& operator--()
+        {
+            tree->prev(l, i);
+            return *this;
+        }
+
+        inline const_iterator operator--(int)
+        {
+            const_iterator it(*this);
+            --*this;
+            return it;
+        }
+
+    protected:
+        const btree_interval_tree* tree = nullptr;
+        leaf*                      l    = nullptr;
+        size_type                  i    = 0;
+    };
+
+    typedef std::reverse_iterator<iterator>       reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> reverse_const_iterator;
+
+public:
+    // ====== CONSTRUCTORS =====================================================
+    btree_interval_tree() = default;
+    explicit btree_interval_tree(const Compare& comp, const Allocator& alloc = Allocator()) :
+        comp(comp),
+        alloc(alloc)
+    {}
+
+    explicit btree_interval_tree(const Allocator& alloc) : alloc(alloc) {}
+
+    template<class InputIt>
+    btree_interval_tree(InputIt first, InputIt last, const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+        comp(comp),
+        alloc(alloc)
+    {
+        insert(first, last);
+    }
+
+    btree_interval_tree(const btree_interval_tree& copy) :
+        comp(copy.comp),
+        alloc(leaf_traits::select_on_container_copy_construction(copy.alloc))
+    {
+        assign_copy(copy);
+    }
+
+    btree_interval_tree(btree_interval_tree&& move) noexcept(std::is_nothrow_move_constructible<Compare>::value) :
+        comp(std::move(move.comp)),
+        alloc(std::move(move.alloc))
+    {
+        steal(move);
+    }
+
+    btree_interval_tree(std::initializer_list<value_type> ilist, const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+        comp(comp),
+        alloc(alloc)
+    {
+        insert(ilist);
+    }
+
+
+
+    // ====== DESTRUCTOR =======================================================
+    ~btree_interval_tree()
+    {
+        clear();
+    }
+
+
+    // ====== ASSIGNMENTS ======================================================
+    btree_interval_tree& operator=(const btree_interval_tree& copy)
+    {
+        if(this == &copy)
+            return *this;
+
+        clear();
+
+        if constexpr(leaf_traits::propagate_on_container_copy_assignment::value)
+            alloc = copy.alloc;
+
+        comp = copy.comp;
+        assign_copy(copy);
+
+        return *this;
+    }
+
+    btree_interval_tree& operator=(btree_interval_tree&& move) noexcept((leaf_traits::propagate_on_container_move_assignment::value ||
+                                                                        leaf_traits::is_always_equal::value) &&
+                                                                       std::is_nothrow_move_assignable<Compare>::value)
+    {
+        if(this == &move)
+            return *this;
+
+        clear();
+
+        comp = std::move(move.comp);
+
+        if constexpr(leaf_traits::propagate_on_container_move_assignment::value)
+        {
+            alloc = std::move(move.alloc);
+            steal(move);
+        }
+        else if(alloc == move.alloc)
+            steal(move);
+        else
+        {
+            for(auto it = move.begin(); it != move.end(); ++it)
+                emplace_hint(end(), std::move(*it));
+
+            move.clear();
+        }
+
+        return *this;
+    }
+
+    btree_interval_tree& operator=(std::initializer_list<value_type> ilist)
+    {
+        clear();
+        insert(ilist);
+
+        return *this;
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type(alloc);
+    }
+
+
+
+    // ====== ITERATORS ========================================================
+    inline iterator begin() noexcept
+    {
+        return iterator(this, first);
+    }
+
+    inline const_iterator begin() const noexcept
+    {
+        return const_iterator(this, first);
+    }
+
+    inline const_iterator cbegin() const noexcept
+    {
+        return const_iterator(this, first);
+    }
+
+    inline iterator end() noexcept
+    {
+        return iterator(this);
+    }
+
+    inline const_iterator end() const noexcept
+    {
+        return const_iterator(this);
+    }
+
+    inline const_iterator cend() const noexcept
+    {
+        return const_iterator(this);
+    }
+
+    inline reverse_iterator rbegin() noexcept
+    {
+        return reverse_iterator(end());
+    }
+
+    inline reverse_const_iterator rbegin() const noexcept
+    {
+        return reverse_const_iterator(end());
+    }
+
+    inline reverse_const_iterator crbegin() const noexcept
+    {
+        return reverse_const_iterator(cend());
+    }
+
+    inline reverse_iterator rend() noexcept
+    {
+        return reverse_iterator(begin());
+    }
+
+    inline reverse_const_iterator rend() const noexcept
+    {
+        return reverse_const_iterator(begin());
+    }
+
+    inline reverse_const_iterator crend() const noexcept
+    {
+        return reverse_const_iterator(cbegin());
+    }
+
+
+
+    // ====== CAPACITY =========================================================
+    bool empty() const noexcept
+    {
+        return node_count == 0;
+    }
+
+    size_type size() const noexcept
+    {
+        return node_count;
+    }
+
+    size_type max_size() const noexcept
+    {
+        return std::numeric_limits<difference_type>::max();
+    }
+
+
+
+    // ===== MODIFIERS =========================================================
+    void clear() noexcept
+    {
+        if(root)
+            destroy(root);
+
+        root       = nullptr;
+        first      = nullptr;
+        last       = nullptr;
+        node_count = 0;
+    }
+
+    iterator insert(const value_type& value)
+    {
+        return emplace(value);
+    }
+
+    iterator insert(value_type&& value)
+    {
+        return emplace(std::move(value));
+    }
+
+    template<class P, typename std::enable_if<std::is_convertible<value_type, P&&>::value, int>::type = 0>
+    iterator insert(P&& value)
+    {
+        return emplace(std::forward<P>(value));
+    }
+
+    iterator insert(const_iterator hint, const value_type& value)
+    {
+        return emplace_hint(hint, value);
+    }
+
+    iterator insert(const_iterator hint, value_type&& value)
+    {
+        return emplace_hint(hint, std::move(value));
+    }
+
+    template<class InputIt>
+    void insert(InputIt first, InputIt last)
+    {
+        while(first != last)
+        {
+            emplace(*first);
+            ++first;
+        }
+    }
+
+    void insert(std::initializer_list<value_type> ilist)
+    {
+        insert(ilist.begin(), ilist.end());
+    }
+
+    template<class... Args>
+    iterator emplace(Args&& ...args)
+    {
+        value_type value(std::forward<Args>(args)...);
+
+        if(comp.less(value.first.second, value.first.first))
+            throw std::range_error("Invalid interval");
+
+        if(!root)
+            return insert_first(std::move(value));
+
+        auto [l, i] = descend<true>(value.first);
+        return insert_at(l, i, std::move(value));
+    }
+
+    // The element is put right before hint if it belongs there
+    template<class... Args>
+    iterator emplace_hint(const_iterator hint, Args&& ...args)
+    {
+        value_type value(std::forward<Args>(args)...);
+
+        if(comp.less(value.first.second, value.first.first))
+            throw std::range_error("Invalid interval");
+
+        if(!root)
+            return insert_first(std::move(value));
+
+        if((hint.l == nullptr || !comp.less(hint->first, value.first)) &&
+           ((hint.l == first && hint.i == 0) || !comp.less(value.first, std::prev(hint)->first)))
+        {
+            if(hint.l)
+                return insert_at(hint.l, hint.i, std::move(value));
+            else
+                return insert_at(last, last->count, std::move(value));
+        }
+
+        auto [l, i] = descend<true>(value.first);
+        return insert_at(l, i, std::move(value));
+    }
+
+    iterator erase(const_iterator pos)
+    {
+        if(pos.l)
+            return remove(pos.l, pos.i);
+        else
+            return iterator(this);
+    }
+
+    iterator erase(iterator pos)
+    {
+        return erase(const_iterator(pos));
+    }
+
+    // Elements move on erase, the count of elements to erase is taken first
+    iterator erase(const_iterator first, const_iterator last)
+    {
+        iterator it(this, first.l, first.i);
+
+        for(auto n = std::distance(first, last); n > 0; --n)
+            it = remove(it.l, it.i);
+
+        return it;
+    }
+
+    size_type erase(const key_type& key)
+    {
+        iterator  it = lower_bound(key);
+        size_type r  = 0;
+
+        while(it.l && comp.eq(it->first, key))
+        {
+            it = remove(it.l, it.i);
+            ++r;
+        }
+
+        return r;
+    }
+
+    void swap(btree_interval_tree& other) noexcept(std::is_nothrow_swappable<Compare>::value)
+    {
+        std::swap(root,       other.root);
+        std::swap(first,      other.first);
+        std::swap(last,       other.last);
+        std::swap(node_count, other.node_count);
+        std::swap(comp,       other.comp);
+
+        if constexpr(leaf_traits::propagate_on_container_swap::value)
+        {
+            using std::swap;
+            swap(alloc, other.alloc);
+        }
+    }
+
+
+
+    // ====== LOOKUP ===========================================================
+    size_type count(const key_type& key) const
+    {
+        return std::distance(lower_bound(key), upper_bound(key));
+    }
+
+    // Calls callback for each element overlapping point (or interval below),
+    // in key order. A callback returning bool stops the search on false.
+    template<class CB>
+    void at(const Key& point, CB callback)       { in(point, point, callback); }
+
+    template<class CB>
+    void at(const Key& point, CB callback) const { in(point, point, callback); }
+
+    std::vector<iterator> at(const Key& point)
+    {
+        std::vector<iterator> r;
+        at(point, [&](iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    std::vector<const_iterator> at(const Key& point) const
+    {
+        std::vector<const_iterator> r;
+        at(point, [&](const_iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    template<class CB>
+    void in(const Key& start, const Key& end, CB callback) { in({start, end}, callback); }
+
+    template<class CB>
+    void in(const Key& start, const Key& end, CB callback) const { in({start, end}, callback); }
+
+    template<class CB>
+    void in(key_type interval, CB callback)
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        if(root)
+            search(root, interval, [&](leaf* l, size_type i){ return call(callback, iterator(this, l, i)); });
+    }
+
+    template<class CB>
+    void in(key_type interval, CB callback) const
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        if(root)
+            search(root, interval, [&](leaf* l, size_type i){ return call(callback, const_iterator(this, l, i)); });
+    }
+
+    std::vector<iterator> in(const Key& start, const Key& end)
+    {
+        std::vector<iterator> r;
+        in(start, end, [&](iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    std::vector<const_iterator> in(const Key& start, const Key& end) const
+    {
+        std::vector<const_iterator> r;
+        in(start, end, [&](const_iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    std::vector<iterator> in(key_type interval)
+    {
+        std::vector<iterator> r;
+        in(interval, [&](iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    std::vector<const_iterator> in(key_type interval) const
+    {
+        std::vector<const_iterator> r;
+        in(interval, [&](const_iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    iterator find(const key_type& k)
+    {
+        iterator it = lower_bound(k);
+        return it.l && comp.eq(it->first, k) ? it : end();
+    }
+
+    const_iterator find(const key_type& k) const
+    {
+        const_iterator it = lower_bound(k);
+        return it.l && comp.eq(it->first, k) ? it : end();
+    }
+
+    std::pair<iterator,iterator> equal_range(const key_type& key)
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    std::pair<const_iterator,const_iterator> equal_range(const key_type& key) const
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    iterator lower_bound(const key_type& k)
+    {
+        auto [l, i] = bound<false>(k);
+        return iterator(this, l, i);
+    }
+
+    const_iterator lower_bound(const key_type& k) const
+    {
+        auto [l, i] = bound<false>(k);
+        return const_iterator(this, l, i);
+    }
+
+    iterator upper_bound(const key_type& k)
+    {
+        auto [l, i] = bound<true>(k);
+        return iterator(this, l, i);
+    }
+
+    const_iterator upper_bound(const key_type& k) const
+    {
+        auto [l, i] = bound<true>(k);
+        return const_iterator(this, l, i);
+    }
+
+
+
+    // ====== OBSERVER =========================================================
+    key_compare key_comp() const
+    {
+        return comp;
+    }
+
+    value_compare value_comp() const
+    {
+        return comp;
+    }
+
+
+
+    // ====== PRIVATE ==========================================================
+private:
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<leaf>  leaf_allocator;
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<inner> inner_allocator;
+    typedef std::allocator_traits<leaf_allocator>                                  leaf_traits;
+    typedef std::allocator_traits<inner_allocator>                                 inner_traits;
+
+    // Nodes a split may need, allocated before the tree is modified
+    struct spare_nodes
+    {
+        leaf*     l = nullptr;
+        inner*    nodes[std::numeric_limits<size_type>::digits];
+        size_type count = 0;
+
+        inner* take() { return nodes[--count]; }
+    };
+
+    inline const key_type&   key(const leaf* l, size_type i)   const { return l->data[i].first;  }
+    inline const bound_type& lower(const leaf* l, size_type i) const { return key(l, i).first;   }
+    inline const bound_type& upper(const leaf* l, size_type i) const { return key(l, i).second;  }
+
+    inline void next(leaf*& l, size_type& i) const
+    {
+        if(!l)
+            l = first;
+        else if(++i == l->count)
+        {
+            l = l->next;
+            i = 0;
+        }
+    }
+
+    inline void prev(leaf*& l, size_type& i) const
+    {
+        if(l && i > 0)
+            --i;
+        else
+        {
+            l = l ? l->prev : last;
+            i = l ? l->count - 1 : 0;
+        }
+    }
+
+    template<class CB, class It>
+    static bool call(CB& callback, It it)
+    {
+        if constexpr(interval_callback_stops<decltype(callback(it))>)
+            return callback(it);
+        else
+        {
+            callback(it);
+            return true;
+        }
+    }
+
+    leaf* create_leaf()
+    {
+        auto p = leaf_traits::allocate(alloc, 1);
+        return ::new(static_cast<void*>(std::addressof(*p))) leaf;
+    }
+
+    inner* create_inner()
+    {
+        inner_allocator a(alloc);
+        auto p = inner_traits::allocate(a, 1);
+        return ::new(static_cast<void*>(std::addressof(*p))) inner;
+    }
+
+    void destroy_leaf(leaf* l) noexcept
+    {
+        l->~leaf();
+        leaf_traits::deallocate(alloc, std::pointer_traits<typename leaf_traits::pointer>::pointer_to(*l), 1);
+    }
+
+    void destroy_inner(inner* p) noexcept
+    {
+        inner_allocator a(alloc);
+        p->~inner();
+        inner_traits::deallocate(a, std::pointer_traits<typename inner_traits::pointer>::pointer_to(*p), 1);
+    }
+
+    void destroy(node_base* n) noexcept
+    {
+        if(n->is_leaf)
+        {
+            leaf* l = static_cast<leaf*>(n);
+
+            for(size_type i = 0; i < l->count; ++i)
+                leaf_traits::destroy(alloc, std::addressof(l->data[i]));
+
+            destroy_leaf(l);
+        }
+        else
+        {
+            inner* p = static_cast<inner*>(n);
+
+            for(size_type i = 0; i < p->count; ++i)
+                destroy(p->children[i]);
+
+            destroy_inner(p);
+        }
+    }
+
+    // Moves the element from src to the free slot dst
+    void relocate(value_type& src, value_type& dst)
+    {
+        leaf_traits::construct(alloc, std::addressof(dst), std::move(src));
+        leaf_traits::destroy(alloc, std::addressof(src));
+    }
+
+    // Moves children [from, to) of src to dst starting at slot at
+    static void move_children(inner* src, size_type from, size_type to, inner* dst, size_type at)
+    {
+        for(; from < to; ++from, ++at)
+        {
+            dst->maxs[at]     = std::move(src->maxs[from]);
+            dst->lowers[at]   = std::move(src->lowers[from]);
+            dst->children[at] = src->children[from];
+
+            dst->children[at]->parent = dst;
+            dst->children[at]->pos    = static_cast<std::uint16_t>(at);
+        }
+    }
+
+    // Moves children [from, count) of p by delta slots
+    static void shift_children(inner* p, size_type from, std::ptrdiff_t delta)
+    {
+        if(delta > 0)
+        {
+            for(size_type i = p->count; i-- > from;)
+                move_children(p, i, i + 1, p, i + delta);
+        }
+        else
+        {
+            for(size_type i = from; i < p->count; ++i)
+                move_children(p, i, i + 1, p, i + delta);
+        }
+    }
+
+    void unlink(leaf* l) noexcept
+    {
+        (l->prev ? l->prev->next : first) = l->next;
+        (l->next ? l->next->prev : last)  = l->prev;
+    }
+
+    const bound_type& first_lower(const node_base* n) const
+    {
+        if(n->is_leaf)
+            return lower(static_cast<const leaf*>(n), 0);
+
+        return static_cast<const inner*>(n)->lowers[0];
+    }
+
+    // Only needed to break ties on the lower bound, the parents don't keep it
+    const bound_type& first_upper(const node_base* n) const
+    {
+        while(!n->is_leaf)
+            n = static_cast<const inner*>(n)->children[0];
+
+        return upper(static_cast<const leaf*>(n), 0);
+    }
+
+    // Whether n is the last node of its level
+    static bool rightmost(const node_base* n)
+    {
+        for(; n->parent; n = n->parent)
+        {
+            if(n->pos + 1u != n->parent->count)
+                return false;
+        }
+
+        return true;
+    }
+
+    bound_type max_of(const node_base* n) const
+    {
+        if(n->is_leaf)
+        {
+            const leaf* l = static_cast<const leaf*>(n);
+            bound_type  m = upper(l, 0);
+
+            for(size_type i = 1; i < l->count; ++i)
+                m = std::max(m, upper(l, i), comp);
+
+            return m;
+        }
+
+        const inner* p = static_cast<const inner*>(n);
+        bound_type   m = p->maxs[0];
+
+        for(size_type i = 1; i < p->count; ++i)
+            m = std::max(m, p->maxs[i], comp);
+
+        return m;
+    }
+
+    // Writes the first lower bound and max of n in its parent
+    void set_slot(const node_base* n)
+    {
+        inner* p = n->parent;
+
+        p->lowers[n->pos] = first_lower(n);
+        p->maxs[n->pos]   = max_of(n);
+    }
+
+    // Updates the slots from n up to the root, stops at the first one that
+    // doesn't change: only n was modified
+    void update(node_base* n)
+    {
+        for(; n->parent; n = n->parent)
+        {
+            inner*     p = n->parent;
+            bound_type m = max_of(n);
+
+            if(comp.eq(first_lower(n), p->lowers[n->pos]) && comp.eq(m, p->maxs[n->pos]))
+                return;
+
+            p->lowers[n->pos] = first_lower(n);
+            p->maxs[n->pos]   = std::move(m);
+        }
+    }
+
+    // Updates the slots from n up to the root, after structural changes
+    void refresh(node_base* n)
+    {
+        for(; n->parent; n = n->parent)
+            set_slot(n);
+    }
+
+    // Leaf and slot of the first element greater than k (not less than k if
+    // is_upper is false). The slot may be the end of the leaf.
+    template<bool is_upper>
+    std::pair<leaf*, size_type> descend(const key_type& k) const
+    {
+        auto before = [&](const bound_type& lo, const bound_type& hi)
+        {
+            if constexpr(is_upper)
+                return !comp.less(k, key_type(lo, hi));
+            else
+                return comp.less(key_type(lo, hi), k);
+        };
+
+        node_base* n = root;
+
+        while(!n->is_leaf)
+        {
+            const inner* p = static_cast<const inner*>(n);
+
+            // Last child starting before k, the first one if none does
+            size_type lo = 1, hi = p->count;
+
+            while(lo < hi)
+            {
+                size_type         mid = (lo + hi) / 2;
+                const bound_type& lb  = p->lowers[mid];
+
+                // the upper bound of the child is only read on a tie
+                if(comp.less(lb, k.first) || (!comp.less(k.first, lb) && before(lb, first_upper(p->children[mid]))))
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+
+            n = p->children[lo - 1];
+        }
+
+        leaf*     l  = static_cast<leaf*>(n);
+        size_type lo = 0, hi = l->count;
+
+        while(lo < hi)
+        {
+            size_type mid = (lo + hi) / 2;
+
+            if(before(lower(l, mid), upper(l, mid)))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        return {l, lo};
+    }
+
+    template<bool is_upper>
+    std::pair<leaf*, size_type> bound(const key_type& k) const
+    {
+        if(!root)
+            return {nullptr, 0};
+
+        auto [l, i] = descend<is_upper>(k);
+
+        if(i == l->count)
+            return {l->next, 0};
+
+        return {l, i};
+    }
+
+    iterator insert_first(value_type&& value)
+    {
+        leaf* l = create_leaf();
+
+        leaf_traits::construct(alloc, std::addressof(l->data[0]), std::move(value));
+        l->count = 1;
+
+        root       = l;
+        first      = l;
+        last       = l;
+        node_count = 1;
+
+        return iterator(this, l, 0);
+    }
+
+    iterator insert_at(leaf* l, size_type i, value_type&& value)
+    {
+        leaf* r = nullptr;
+        spare_nodes spare;
+
+        if(l->count == leaf_slots)
+        {
+            allocate_split(l, spare);
+
+            // Appending to the last leaf leaves it full, the new leaf only
+            // gets the new element: sorted input fills the leaves
+            r = split_leaf(l, spare.l, i == leaf_slots && l == last ? leaf_slots : leaf_slots / 2);
+
+            if(i > l->count || l->count == leaf_slots)
+            {
+                i -= l->count;
+                l  = r;
+            }
+        }
+
+        for(size_type j = l->count; j > i; --j)
+            relocate(l->data[j - 1], l->data[j]);
+
+        leaf_traits::construct(alloc, std::addressof(l->data[i]), std::move(value));
+        l->count++;
+        node_count++;
+
+        if(r)
+            insert_child(r->prev, r, spare);
+        else
+            update(l);
+
+        return iterator(this, l, i);
+    }
+
+    void allocate_split(const leaf* l, spare_nodes& spare)
+    {
+        try
+        {
+            spare.l = create_leaf();
+
+            for(inner* p = l->parent; ; p = p->parent)
+            {
+                if(p && p->count < inner_slots)
+                    break;
+
+                spare.nodes[spare.count++] = create_inner();
+
+                if(!p)
+                    break;
+            }
+        }
+        catch(...)
+        {
+            if(spare.l)
+                destroy_leaf(spare.l);
+
+            while(spare.count)
+                destroy_inner(spare.take());
+
+            throw;
+        }
+    }
+
+    // Moves the elements of l from slot at to the new leaf r, right after l
+    leaf* split_leaf(leaf* l, leaf* r, size_type at)
+    {
+        for(size_type j = at; j < l->count; ++j)
+            relocate(l->data[j], r->data[j - at]);
+
+        r->count = static_cast<std::uint16_t>(l->count - at);
+        l->count = static_cast<std::uint16_t>(at);
+
+        r->prev = l;
+        r->next = l->next;
+        (l->next ? l->next->prev : last) = r;
+        l->next = r;
+
+        return r;
+    }
+
+    // Puts right after left in the parent of left, splitting the parents
+    // that are full. Both nodes hold their final content.
+    void insert_child(node_base* left, node_base* right, spare_nodes& spare)
+    {
+        inner* p = left->parent;
+
+        if(!p)
+        {
+            p = spare.take();
+            p->count       = 1;
+            p->children[0] = left;
+            left->parent   = p;
+            left->pos      = 0;
+            root           = p;
+        }
+        else if(p->count == inner_slots)
+        {
+            // Same as the leaves, on the right edge only
+            inner*    q  = spare.take();
+            size_type at = left->pos + 1u == inner_slots && rightmost(p) ? inner_slots - 1 : inner_slots / 2;
+
+            move_children(p, at, p->count, q, 0);
+            q->count = static_cast<std::uint16_t>(p->count - at);
+            p->count = static_cast<std::uint16_t>(at);
+
+            insert_child(p, q, spare);
+            p = left->parent;
+        }
+
+        shift_children(p, left->pos + 1u, 1);
+        p->children[left->pos + 1u] = right;
+        right->parent = p;
+        right->pos    = left->pos + 1u;
+        p->count++;
+
+        set_slot(left);
+        refresh(right);
+    }
+
+    // Erases the element at slot i of l, then takes elements from a sibling
+    // or merges with it if l is left too small. Returns the next element.
+    iterator remove(leaf* l, size_type i)
+    {
+        leaf_traits::destroy(alloc, std::addressof(l->data[i]));
+
+        for(size_type j = i + 1; j < l->count; ++j)
+            relocate(l->data[j], l->data[j - 1]);
+
+        l->count--;
+        node_count--;
+
+        if(l == root)
+        {
+            if(!l->count)
+            {
+                destroy_leaf(l);
+                root  = nullptr;
+                first = nullptr;
+                last  = nullptr;
+                return end();
+            }
+        }
+        else if(l->count >= leaf_min)
+            update(l);
+        else
+        {
+            inner* p     = l->parent;
+            leaf*  left  = l->pos > 0            ? static_cast<leaf*>(p->children[l->pos - 1]) : nullptr;
+            leaf*  right = l->pos + 1u < p->count ? static_cast<leaf*>(p->children[l->pos + 1]) : nullptr;
+
+            if(left && left->count > leaf_min)
+            {
+                for(size_type j = l->count; j > 0; --j)
+                    relocate(l->data[j - 1], l->data[j]);
+
+                relocate(left->data[left->count - 1], l->data[0]);
+                left->count--;
+                l->count++;
+                i++;
+
+                update(left);
+                update(l);
+            }
+            else if(right && right->count > leaf_min)
+            {
+                relocate(right->data[0], l->data[l->count]);
+                l->count++;
+
+                for(size_type j = 1; j < right->count; ++j)
+                    relocate(right->data[j], right->data[j - 1]);
+
+                right->count--;
+
+                update(right);
+                update(l);
+            }
+            else
+            {
+                // Merge with a sibling, the right one is emptied into the left
+                // one and removed
+                if(!left)
+                {
+                    left  = l;
+                    l     = right;
+                }
+                else
+                    i += left->count;
+
+                for(size_type j = 0; j < l->count; ++j)
+                    relocate(l->data[j], left->data[left->count + j]);
+
+                left->count = static_cast<std::uint16_t>(left->count + l->count);
+
+                size_type at = l->pos;
+
+                unlink(l);
+                destroy_leaf(l);
+                set_slot(left);
+                remove_child(p, at);
+
+                l = left;
+            }
+        }
+
+        if(i == l->count)
+            return iterator(this, l->next, 0);
+
+        return iterator(this, l, i);
+    }
+
+    void remove_child(inner* p, size_type at)
+    {
+        shift_children(p, at + 1, -1);
+        p->count--;
+
+        rebalance(p);
+    }
+
+    // Same as the leaves in remove(), for an internal node that lost a child
+    void rebalance(inner* p)
+    {
+        inner* g = p->parent;
+
+        if(!g)
+        {
+            if(p->count == 1)
+            {
+                root         = p->children[0];
+                root->parent = nullptr;
+                root->pos    = 0;
+                destroy_inner(p);
+            }
+
+            return;
+        }
+
+        if(p->count >= inner_min)
+        {
+            refresh(p);
+            return;
+        }
+
+        inner* left  = p->pos > 0            ? static_cast<inner*>(g->children[p->pos - 1]) : nullptr;
+        inner* right = p->pos + 1u < g->count ? static_cast<inner*>(g->children[p->pos + 1]) : nullptr;
+
+        if(left && left->count > inner_min)
+        {
+            shift_children(p, 0, 1);
+            move_children(left, left->count - 1, left->count, p, 0);
+            left->count--;
+            p->count++;
+
+            refresh(left);
+            refresh(p);
+        }
+        else if(right && right->count > inner_min)
+        {
+            move_children(right, 0, 1, p, p->count);
+            p->count++;
+            shift_children(right, 1, -1);
+            right->count--;
+
+            refresh(right);
+            refresh(p);
+        }
+        else
+        {
+            if(!left)
+            {
+                left = p;
+                p    = right;
+            }
+
+            move_children(p, 0, p->count, left, left->count);
+            left->count = static_cast<std::uint16_t>(left->count + p->count);
+
+            size_type at = p->pos;
+
+            destroy_inner(p);
+            set_slot(left);
+            remove_child(g, at);
+        }
+    }
+
+    // Calls cb with the leaf and slot of each element of n overlapping
+    // interval, in key order. Returns false if cb stopped the search.
+    template<class CB>
+    bool search(node_base* n, const key_type& interval, const CB& cb) const
+    {
+        if(n->is_leaf)
+        {
+            leaf* l = static_cast<leaf*>(n);
+
+            for(size_type i = 0; i < l->count && comp.less_eq(lower(l, i), interval.second); ++i)
+            {
+                if(comp.greater_eq(upper(l, i), interval.first) && !cb(l, i))
+                    return false;
+            }
+
+            return true;
+        }
+
+        const inner* p = static_cast<const inner*>(n);
+
+        for(size_type i = 0; i < p->count && comp.less_eq(p->lowers[i], interval.second); ++i)
+        {
+            if(comp.greater_eq(p->maxs[i], interval.first) && !search(p->children[i], interval, cb))
+                return false;
+        }
+
+        return true;
+    }
+
+    void assign_copy(const btree_interval_tree& copy)
+    {
+        for(auto& v : copy)
+            emplace_hint(end(), v);
+    }
+
+    void steal(btree_interval_tree& move) noexcept
+    {
+        root       = move.root;
+        first      = move.first;
+        last       = move.last;
+        node_count = move.node_count;
+
+        move.root       = nullptr;
+        move.first      = nullptr;
+        move.last       = nullptr;
+        move.node_count = 0;
+    }
+
+#ifdef INTERVAL_TREE_UNIT_TESTING
+public:
+    // Checks links, ordering, fill and the slots of every internal node
+    bool __check_invariants() const {
+        size_type   c    = 0;
+        int         leaf_depth = -1;
+        const leaf* prev = nullptr;
+
+        if(!root)
+            return !first && !last && !node_count;
+
+        return !root->parent && __check_node(root, 0, leaf_depth, prev, c) && prev == last && !last->next && c == node_count;
+    }
+
+private:
+    bool __check_node(const node_base* n, int depth, int& leaf_depth, const leaf*& prev, size_type& c) const {
+        if(!n->count || (n != root && !n->is_leaf && n->count < 2))
+            return false;
+
+        if(n != root && !rightmost(n) && n->count < (n->is_leaf ? leaf_min : inner_min))
+            return false;
+
+        if(n->is_leaf)
+        {
+            const leaf* l = static_cast<const leaf*>(n);
+
+            if(l->count > leaf_slots || l->prev != prev || (prev ? prev->next != l : first != l))
+                return false;
+
+            if(leaf_depth < 0)
+                leaf_depth = depth;
+
+            for(size_type i = 0; i < l->count; ++i)
+            {
+                if((i > 0 && comp.less(key(l, i), key(l, i - 1))) || (i == 0 && prev && comp.less(key(l, 0), key(prev, prev->count - 1))))
+                    return false;
+            }
+
+            c   += l->count;
+            prev = l;
+
+            return depth == leaf_depth;
+        }
+
+        const inner* p = static_cast<const inner*>(n);
+
+        if(p->count > inner_slots)
+            return false;
+
+        for(size_type i = 0; i < p->count; ++i)
+        {
+            const node_base* child = p->children[i];
+
+            if(child->parent != p || child->pos != i || !__check_node(child, depth + 1, leaf_depth, prev, c))
+                return false;
+
+            if(comp.neq(first_lower(child), p->lowers[i]) || comp.neq(max_of(child), p->maxs[i]))
+                return false;
+        }
+
+        return true;
+    }
+#endif
+
+private:
+    node_base*     root       = nullptr;
+    leaf*          first      = nullptr;
+    leaf*          last       = nullptr;
+    size_type      node_count = 0;
+    comparator     comp;
+    leaf_allocator alloc;
+};
+
+template<class K, class T, class C, class A>
+void swap(btree_interval_tree<K, T, C, A>& lhs,
+          btree_interval_tree<K, T, C, A>& rhs) noexcept(noexcept(lhs.swap(rhs)))
+{
+    lhs.swap(rhs);
+}
+
+template<class K, class T, class C, class A>
+bool operator==(const btree_interval_tree<K, T, C, A>& lhs,
+                const btree_interval_tree<K, T, C, A>& rhs)
+{
+    return lhs.size() == rhs.size() && std::equal(lhs.cbegin(), lhs.cend(), rhs.cbegin());
+}
+
+template<class K, class T, class C, class A>
+bool operator!=(const btree_interval_tree<K, T, C, A>& lhs,
+                const btree_interval_tree<K, T, C, A>& rhs)
+{
+    return !(lhs == rhs);
+}
+
+#endif // BTREE_INTERVAL_TREE_H
@@ -0,0 +1,1388 @@
+#ifndef COMPACT_INTERVAL_TREE_H
+#define COMPACT_INTERVAL_TREE_H
+
+#include <cstdint>
+
+#include <interval_tree.h>
+
+// Same container as interval_tree, but the nodes are kept in a single
+// contiguous array and linked with 32 bit indices. Height and balance factor
+// share a single byte. Iterators are indices and survive the array growth,
+// references and pointers to elements don't (use reserve() to avoid it).
+template<
+    typename Key,
+    typename T,
+    typename Compare = std::less<Key>,
+    typename Allocator = std::allocator<std::pair<std::pair<Key, Key>, T>>,
+    typename std::enable_if<std::is_default_constructible<Key>::value, int>::type = 0
+>
+class compact_interval_tree
+{
+public:
+    // ====== TYPEDEFS =========================================================
+    typedef Key                                    bound_type;
+    typedef std::pair<Key, Key>                    key_type;
+    typedef T                                      mapped_type;
+
+    typedef std::size_t                            size_type;
+    typedef std::ptrdiff_t                         difference_type;
+    typedef std::pair<key_type, mapped_type>       value_type;
+    typedef value_type*                            pointer;
+    typedef const value_type*                      const_pointer;
+    typedef value_type&                            reference;
+    typedef const value_type&                      const_reference;
+    typedef Allocator                              allocator_type;
+
+    typedef std::uint32_t                          index_type;
+
+
+
+private:
+    // ====== NODE =============================================================
+    static constexpr index_type nil = std::numeric_limits<index_type>::max();
+
+    struct node
+    {
+        // data is left uninitialized here, it is constructed and destroyed
+        // through the allocator (see create_node / destroy_node)
+        node() {}
+        ~node() {}
+
+        index_type parent;
+        index_type left;
+        index_type right;
+
+        // height * 5 + bfactor + 2. An AVL tree indexed on 32 bits is at most
+        // 46 levels high so it always fits, 0 marks a free slot.
+        std::uint8_t meta;
+
+        bound_type  max;
+
+        union { value_type data; };
+    };
+
+    static inline std::uint8_t pack(int height, int bfactor)
+    {
+        return static_cast<std::uint8_t>(height * 5 + bfactor + 2);
+    }
+
+public:
+    // ====== KEY COMPARE ======================================================
+    typedef interval_comparator<Key, T, Compare> comparator;
+
+    typedef comparator key_compare;
+    typedef comparator value_compare;
+
+
+
+    // ====== ITERATOR =========================================================
+    class iterator
+    {
+        friend class compact_interval_tree;
+
+    public:
+        typedef compact_interval_tree::difference_type  difference_type;
+        typedef compact_interval_tree::value_type       value_type;
+        typedef compact_interval_tree::pointer          pointer;
+        typedef compact_interval_tree::const_pointer    const_pointer;
+        typedef compact_interval_tree::reference        reference;
+        typedef compact_interval_tree::const_reference  const_reference;
+        typedef std::bidirectional_iterator_tag         iterator_category;
+
+    protected:
+        iterator(const compact_interval_tree* t, index_type i = nil) : tree(t), i(i) {}
+
+    public:
+        iterator() = default;
+
+        inline void swap(iterator& other) noexcept
+        {
+            std::swap(tree, other.tree);
+            std::swap(i, other.i);
+        }
+
+        inline bool operator==(const iterator& other) const { return i == other.i; }
+        inline bool operator!=(const iterator& other) const { return !(*this == other); }
+
+        inline reference operator*()  { return tree->nodes[i].data;  }
+        inline pointer   operator->() { return &tree->nodes[i].data; }
+
+        inline const_reference operator*()  const { return tree->nodes[i].data;  }
+        inline const_pointer   operator->() const { return &tree->nodes[i].data; }
+
+        inline iterator& operator++()
+        {
+            if(i != nil)
+                i = tree->next(i);
+            else
+                i = tree->root != nil ? tree->leftest(tree->root) : nil;
+
+            return *this;
+        }
+
+        inline iterator  operator++(int)
+        {
+            iterator it(*this);
+            ++*this;
+            return it;
+        }
+
+        inline iterator& operator--()
+        {
+            if(i != nil)
+                i = tree->prev(i);
+            else
+                i = tree->root != nil ? tree->rightest(tree->root) : nil;
+
+            return *this;
+        }
+
+        inline iterator  operator--(int)
+        {
+            iterator it(*this);
+            --*this;
+            return it;
+        }
+
+    protected:
+        const compact_interval_tree* tree = nullptr;
+        index_type                   i    = nil;
+    };
+
+
+
+    class const_iterator
+    {
+        friend class compact_interval_tree;
+
+    public:
+        typedef compact_interval_tree::difference_type  difference_type;
+        typedef compact_interval_tree::value_type       value_type;
+        typedef compact_interval_tree::const_pointer    pointer;
+        typedef compact_interval_tree::const_pointer    const_pointer;
+        typedef compact_interval_tree::const_reference  reference;
+        typedef compact_interval_tree::const_reference  const_reference;
+        typedef std::bidirectional_iterator_tag         iterator_category;
+
+    protected:
+        const_iterator(const compact_interval_tree* t, index_type i = nil) : tree(t), i(i) {}
+
+    public:
+        const_iterator() = default;
+        const_iterator(const iterator& copy) : tree(copy.tree), i(copy.i) {}
+
+        inline void swap(const_iterator& other) noexcept
+        {
+            std::swap(tree, other.tree);
+            std::swap(i, other.i);
+        }
+
+        inline bool operator==(const const_iterator& other) const { return i == other.i; }
+        inline bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+        inline reference operator*()  const { return tree->nodes[i].data;  }
+        inline pointer   operator->() const { return &tree->nodes[i].data; }
+
+        inline const_iterator& operator++()
+        {
+            if(i != nil)
+                i = tree->next(i);
+            else
+                i = tree->root != nil ? tree->leftest(tree->root) : nil;
+
+            return *this;
+        }
+
+        inline const_iterator operator++(int)
+        {
+            const_iterator it(*this);
+            ++*this;
+            return it;
+        }
+
+        inline const_iterator& operator--()
+        {
+            if(i != nil)
+                i = tree->prev(i);
+            else
+                i = tree->root != nil ? tree->rightest(tree->root) : nil;
+
+            return *this;
+        }
+
+        inline const_iterator operator--(int)
+        {
+            const_iterator it(*this);
+            --*this;
+            return it;
+        }
+
+    protected:
+        const compact_interval_tree* tree = nullptr;
+        index_type                   i    = nil;
+    };
+
+    typedef std::reverse_iterator<iterator>       reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> reverse_const_iterator;
+
+public:
+    // ====== CONSTRUCTORS =====================================================
+    compact_interval_tree() = default;
+    explicit compact_interval_tree(const Compare& comp, const Allocator& alloc = Allocator()) :
+        comp(comp),
+        alloc(alloc)
+    {}
+
+    explicit compact_interval_tree(const Allocator& alloc) : alloc(alloc) {}
+
+    template<class InputIt>
+    compact_interval_tree(InputIt first, InputIt last, const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+        comp(comp),
+        alloc(alloc)
+    {
+        insert(first, last);
+    }
+
+    compact_interval_tree(const compact_interval_tree& copy) :
+        comp(copy.comp),
+        alloc(node_traits::select_on_container_copy_construction(copy.alloc))
+    {
+        assign_copy(copy);
+    }
+
+    compact_interval_tree(compact_interval_tree&& move) noexcept(std::is_nothrow_move_constructible<Compare>::value) :
+        comp(std::move(move.comp)),
+        alloc(std::move(move.alloc))
+    {
+        steal(move);
+    }
+
+    compact_interval_tree(std::initializer_list<value_type> ilist, const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+        comp(comp),
+        alloc(alloc)
+    {
+        insert(ilist);
+    }
+
+
+
+    // ====== DESTRUCTOR =======================================================
+    ~compact_interval_tree()
+    {
+        clear();
+        release();
+    }
+
+
+    // ====== ASSIGNMENTS ======================================================
+    compact_interval_tree& operator=(const compact_interval_tree& copy)
+    {
+        if(this == &copy)
+            return *this;
+
+        clear();
+        release();
+
+        if constexpr(node_traits::propagate_on_container_copy_assignment::value)
+            alloc = copy.alloc;
+
+        comp = copy.comp;
+        assign_copy(copy);
+
+        return *this;
+    }
+
+    compact_interval_tree& operator=(compact_interval_tree&& move) noexcept((node_traits::propagate_on_container_move_assignment::value ||
+                                                                            node_traits::is_always_equal::value) &&
+                                                                           std::is_nothrow_move_assignable<Compare>::value)
+    {
+        if(this == &move)
+            return *this;
+
+        clear();
+
+        comp = std::move(move.comp);
+
+        if constexpr(node_traits::propagate_on_container_move_assignment::value)
+        {
+            release();
+            alloc = std::move(move.alloc);
+            steal(move);
+        }
+        else if(alloc == move.alloc)
+        {
+            release();
+            steal(move);
+        }
+        else
+        {
+            for(auto it = move.begin(); it != move.end(); ++it)
+                emplace_hint(end(), std::move(*it));
+
+            move.clear();
+        }
+
+        return *this;
+    }
+
+    compact_interval_tree& operator=(std::initializer_list<value_type> ilist)
+    {
+        clear();
+        insert(ilist);
+
+        return *this;
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type(alloc);
+    }
+
+
+
+    // ====== ITERATORS ========================================================
+    inline iterator begin() noexcept
+    {
+        return iterator(this, root != nil ? leftest(root) : nil);
+    }
+
+    inline const_iterator begin() const noexcept
+    {
+        return const_iterator(this, root != nil ? leftest(root) : nil);
+    }
+
+    inline const_iterator cbegin() const noexcept
+    {
+        return const_iterator(this, root != nil ? leftest(root) : nil);
+    }
+
+    inline iterator end() noexcept
+    {
+        return iterator(this);
+    }
+
+    inline const_iterator end() const noexcept
+    {
+        return const_iterator(this);
+    }
+
+    inline const_iterator cend() const noexcept
+    {
+        return const_iterator(this);
+    }
+
+    inline reverse_iterator rbegin() noexcept
+    {
+        return reverse_iterator(end());
+    }
+
+    inline reverse_const_iterator rbegin() const noexcept
+    {
+        return reverse_const_iterator(end());
+    }
+
+    inline reverse_const_iterator crbegin() const noexcept
+    {
+        return reverse_const_iterator(cend());
+    }
+
+    inline reverse_iterator rend() noexcept
+    {
+        return reverse_iterator(begin());
+    }
+
+    inline reverse_const_iterator rend() const noexcept
+    {
+        return reverse_const_iterator(begin());
+    }
+
+    inline reverse_const_iterator crend() const noexcept
+    {
+        return reverse_const_iterator(cbegin());
+    }
+
+
+
+    // ====== CAPACITY =========================================================
+    bool empty() const noexcept
+    {
+        return node_count == 0;
+    }
+
+    size_type size() const noexcept
+    {
+        return node_count;
+    }
+
+    size_type max_size() const noexcept
+    {
+        return nil;
+    }
+
+    size_type capacity() const noexcept
+    {
+        return slots;
+    }
+
+    void reserve(size_type n)
+    {
+        if(n > max_size())
+            throw std::length_error("compact_interval_tree::reserve");
+
+        if(n > slots)
+            grow(static_cast<index_type>(n));
+    }
+
+    // Moves the elements to the front of the array in key order and releases
+    // the unused slots. Invalidates all the iterators.
+    void shrink_to_fit()
+    {
+        if(node_count == slots)
+            return;
+
+        compact_interval_tree tmp(get_allocator());
+        tmp.comp = comp;
+        tmp.reserve(node_count);
+
+        for(auto it = begin(); it != end(); ++it)
+            tmp.emplace_hint(tmp.end(), std::move(*it));
+
+        clear();
+        release();
+        steal(tmp);
+    }
+
+
+
+    // ===== MODIFIERS =========================================================
+    void clear() noexcept
+    {
+        for(index_type i = 0; i < used; ++i)
+        {
+            if(nodes[i].meta)
+                node_traits::destroy(alloc, std::addressof(nodes[i].data));
+
+            nodes[i].~node();
+        }
+
+        root       = nil;
+        free_list  = nil;
+        used       = 0;
+        node_count = 0;
+    }
+
+    iterator insert(const value_type& value)
+    {
+        return emplace(value);
+    }
+
+    iterator insert(value_type&& value)
+    {
+        return emplace(std::move(value));
+    }
+
+    template<class P, typename std::enable_if<std::is_convertible<value_type, P&&>::value, int>::type = 0>
+    iterator insert(P&& value)
+    {
+        return emplace(std::forward<P>(value));
+    }
+
+    iterator insert(const_iterator hint, const value_type& value)
+    {
+        return emplace_hint(hint, value);
+    }
+
+    iterator insert(const_iterator hint, value_type&& value)
+    {
+        return emplace_hint(hint, std::move(value));
+    }
+
+    template<class InputIt>
+    void insert(InputIt first, InputIt last)
+    {
+        while(first != last)
+        {
+            emplace(*first);
+            ++first;
+        }
+    }
+
+    void insert(std::initializer_list<value_type> ilist)
+    {
+        insert(ilist.begin(), ilist.end());
+    }
+
+    template<class... Args>
+    iterator emplace(Args&& ...args)
+    {
+        index_type n = create_node(std::forward<Args>(args)...);
+
+        if(root != nil)
+            insert(n, find_leaf_high(nodes[n].data.first));
+        else
+        {
+            node_count ++;
+            root = n;
+        }
+
+        return iterator(this, n);
+    }
+
+    template<class... Args>
+    iterator emplace_hint(const_iterator hint, Args&& ...args)
+    {
+        index_type n = create_node(std::forward<Args>(args)...);
+
+        if(root != nil)
+            insert(n, find_leaf(hint, nodes[n].data.first));
+        else
+        {
+            node_count ++;
+            root = n;
+        }
+
+        return iterator(this, n);
+    }
+
+    iterator erase(const_iterator pos)
+    {
+        if(pos.i != nil)
+            return iterator(this, remove(pos.i));
+        else
+            return iterator(this);
+    }
+
+    iterator erase(iterator pos)
+    {
+        return erase(const_iterator(pos));
+    }
+
+    iterator erase(const_iterator first, const_iterator last)
+    {
+        while(first != last)
+            first = const_iterator(this, remove(first.i));
+
+        return iterator(this, last.i);
+    }
+
+    size_type erase(const key_type& key)
+    {
+        index_type n = lower_bound(root, key);
+        size_type  r = 0;
+
+        while(n != nil && comp.eq(nodes[n].data.first, key))
+        {
+            n = remove(n);
+            ++r;
+        }
+
+        return r;
+    }
+
+    void swap(compact_interval_tree& other) noexcept(std::is_nothrow_swappable<Compare>::value)
+    {
+        std::swap(nodes,      other.nodes);
+        std::swap(slots,      other.slots);
+        std::swap(used,       other.used);
+        std::swap(free_list,  other.free_list);
+        std::swap(root,       other.root);
+        std::swap(node_count, other.node_count);
+        std::swap(comp,       other.comp);
+
+        if constexpr(node_traits::propagate_on_container_swap::value)
+        {
+            using std::swap;
+            swap(alloc, other.alloc);
+        }
+    }
+
+
+
+    // ====== LOOKUP ===========================================================
+    size_type count(const key_type& key) const
+    {
+        return std::distance(lower_bound(key), upper_bound(key));
+    }
+
+    template<class CB>
+    void at(const Key& point, CB callback)       { in(point, point, callback); }
+
+    template<class CB>
+    void at(const Key& point, CB callback) const { in(point, point, callback); }
+
+    std::vector<iterator> at(const Key& point)
+    {
+        std::vector<iterator> r;
+        at(point, [&](iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    std::vector<const_iterator> at(const Key& point) const
+    {
+        std::vector<const_iterator> r;
+        at(point, [&](const_iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    template<class CB>
+    void in(const Key& start, const Key& end, CB callback) { in({start, end}, callback); }
+
+    template<class CB>
+    void in(const Key& start, const Key& end, CB callback) const { in({start, end}, callback); }
+
+    template<class CB>
+    void in(key_type interval, CB callback)
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        if(root != nil)
+            search(root, interval, [&](index_type n){ return callback(iterator(this, n)); });
+    }
+
+    template<class CB>
+    void in(key_type interval, CB callback) const
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        if(root != nil)
+            search(root, interval, [&](index_type n){ return callback(const_iterator(this, n)); });
+    }
+
+    std::vector<iterator> in(const Key& start, const Key& end)
+    {
+        std::vector<iterator> r;
+        in(start, end, [&](iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    std::vector<const_iterator> in(const Key& start, const Key& end) const
+    {
+        std::vector<const_iterator> r;
+        in(start, end, [&](const_iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    std::vector<iterator> in(key_type interval)
+    {
+        std::vector<iterator> r;
+        in(interval, [&](iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    std::vector<const_iterator> in(key_type interval) const
+    {
+        std::vector<const_iterator> r;
+        in(interval, [&](const_iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    iterator find(const key_type& k)
+    {
+        return iterator(this, find_node(k));
+    }
+
+    const_iterator find(const key_type& k) const
+    {
+        return const_iterator(this, find_node(k));
+    }
+
+    std::pair<iterator,iterator> equal_range(const key_type& key)
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    std::pair<const_iterator,const_iterator> equal_range(const key_type& key) const
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    iterator lower_bound(const key_type& k)
+    {
+        return iterator(this, lower_bound(root, k));
+    }
+
+    const_iterator lower_bound(const key_type& k) const
+    {
+        return const_iterator(this, lower_bound(root, k));
+    }
+
+    iterator upper_bound(const key_type& k)
+    {
+        return iterator(this, upper_bound(root, k));
+    }
+
+    const_iterator upper_bound(const key_type& k) const
+    {
+        return const_iterator(this, upper_bound(root, k));
+    }
+
+
+
+    // ====== OBSERVER =========================================================
+    key_compare key_comp() const
+    {
+        return comp;
+    }
+
+    value_compare value_comp() const
+    {
+        return comp;
+    }
+
+
+
+    // ====== PRIVATE ==========================================================
+private:
+    // AVL height bound for as many nodes as index_type can address
+    static constexpr std::size_t max_depth = std::numeric_limits<index_type>::digits * 3 / 2;
+
+    inline int height(index_type n) const
+    {
+        return n != nil ? nodes[n].meta / 5 : 0;
+    }
+
+    inline int bfactor(index_type n) const
+    {
+        return nodes[n].meta % 5 - 2;
+    }
+
+    inline const key_type&   key(index_type n)   const { return nodes[n].data.first;  }
+    inline const bound_type& lower(index_type n) const { return key(n).first;         }
+    inline const bound_type& upper(index_type n) const { return key(n).second;        }
+
+    void grow(index_type n)
+    {
+        auto  p     = node_traits::allocate(alloc, n);
+        node* store = std::addressof(*p);
+
+        // Relocate slot by slot, indices stay the same so the links and the
+        // free list are carried over as is
+        for(index_type i = 0; i < used; ++i)
+        {
+            node& src = nodes[i];
+            node* dst = ::new(static_cast<void*>(store + i)) node;
+
+            dst->parent = src.parent;
+            dst->left   = src.left;
+            dst->right  = src.right;
+            dst->meta   = src.meta;
+
+            if(src.meta)
+            {
+                dst->max = std::move(src.max);
+                node_traits::construct(alloc, std::addressof(dst->data), std::move(src.data));
+                node_traits::destroy(alloc, std::addressof(src.data));
+            }
+
+            src.~node();
+        }
+
+        if(nodes)
+            node_traits::deallocate(alloc, std::pointer_traits<typename node_traits::pointer>::pointer_to(*nodes), slots);
+
+        nodes = store;
+        slots = n;
+    }
+
+    // Must be called on a cleared tree
+    void release() noexcept
+    {
+        if(nodes)
+            node_traits::deallocate(alloc, std::pointer_traits<typename node_traits::pointer>::pointer_to(*nodes), slots);
+
+        nodes = nullptr;
+        slots = 0;
+    }
+
+    template<class... Args>
+    index_type create_node(Args&& ...args)
+    {
+        if(free_list == nil)
+        {
+            if(used == nil)
+                throw std::length_error("compact_interval_tree is full");
+
+            if(used == slots)
+                grow(static_cast<index_type>(std::min<size_type>(std::max<size_type>(size_type(slots) * 2, 16), nil)));
+
+            ::new(static_cast<void*>(nodes + used)) node;
+            nodes[used].meta   = 0;
+            nodes[used].parent = nil;
+            free_list          = used++;
+        }
+
+        index_type n = free_list;
+
+        node_traits::construct(alloc, std::addressof(nodes[n].data), std::forward<Args>(args)...);
+
+        free_list       = nodes[n].parent;
+        nodes[n].parent = nil;
+        nodes[n].left   = nil;
+        nodes[n].right  = nil;
+        nodes[n].meta   = pack(1, 0);
+        nodes[n].max    = upper(n);
+
+        return n;
+    }
+
+    void destroy_node(index_type n)
+    {
+        node_traits::destroy(alloc, std::addressof(nodes[n].data));
+
+        nodes[n].meta   = 0;
+        nodes[n].parent = free_list;
+        free_list       = n;
+    }
+
+    void assign_copy(const compact_interval_tree& copy)
+    {
+        if(!copy.used)
+            return;
+
+        grow(copy.used);
+
+        for(index_type i = 0; i < copy.used; ++i)
+        {
+            const node& src = copy.nodes[i];
+            node*       dst = ::new(static_cast<void*>(nodes + i)) node;
+
+            dst->parent = src.parent;
+            dst->left   = src.left;
+            dst->right  = src.right;
+            dst->meta   = 0;
+            used        = i + 1;
+
+            if(src.meta)
+            {
+                node_traits::construct(alloc, std::addressof(dst->data), src.data);
+                dst->max  = src.max;
+                dst->meta = src.meta;
+            }
+        }
+
+        free_list  = copy.free_list;
+        root       = copy.root;
+        node_count = copy.node_count;
+    }
+
+    void steal(compact_interval_tree& move) noexcept
+    {
+        nodes      = move.nodes;
+        slots      = move.slots;
+        used       = move.used;
+        free_list  = move.free_list;
+        root       = move.root;
+        node_count = move.node_count;
+
+        move.nodes      = nullptr;
+        move.slots      = 0;
+        move.used       = 0;
+        move.free_list  = nil;
+        move.root       = nil;
+        move.node_count = 0;
+    }
+
+    // Recomputes max, height and balance factor of n from its children.
+    // Returns true if max or height changed, the parent then needs an update.
+    bool update_props(index_type n)
+    {
+        node&      c = nodes[n];
+        bound_type m = upper(n);
+        int        h = 1;
+        int        b = 0;
+
+        if(c.right != nil)
+        {
+            m = std::max(m, nodes[c.right].max, comp);
+            h = height(c.right) + 1;
+            b = height(c.right);
+        }
+
+        if(c.left != nil)
+        {
+            m  = std::max(m, nodes[c.left].max, comp);
+            h  = std::max(h, height(c.left) + 1);
+            b -= height(c.left);
+        }
+
+        bool changed = h != height(n) || comp.neq(m, c.max);
+
+        c.max  = m;
+        c.meta = pack(h, b);
+
+        return changed;
+    }
+
+    // Updates n and its ancestors up to the first one left unchanged
+    void update_path(index_type n)
+    {
+        while(n != nil && update_props(n))
+            n = nodes[n].parent;
+    }
+
+    inline bool is_left_child(index_type n) const
+    {
+        return n == nodes[nodes[n].parent].left;
+    }
+
+    inline index_type leftest(index_type n) const
+    {
+        while(nodes[n].left != nil)
+            n = nodes[n].left;
+
+        return n;
+    }
+
+    inline index_type rightest(index_type n) const
+    {
+        while(nodes[n].right != nil)
+            n = nodes[n].right;
+
+        return n;
+    }
+
+    inline index_type next(index_type n) const
+    {
+        if(nodes[n].right != nil)
+            return leftest(nodes[n].right);
+
+        while(nodes[n].parent != nil && !is_left_child(n))
+            n = nodes[n].parent;
+
+        return nodes[n].parent;
+    }
+
+    inline index_type prev(index_type n) const
+    {
+        if(nodes[n].left != nil)
+            return rightest(nodes[n].left);
+
+        while(nodes[n].parent != nil && is_left_child(n))
+            n = nodes[n].parent;
+
+        return nodes[n].parent;
+    }
+
+    void replace_child(index_type p, index_type old, index_type n)
+    {
+        if(p == nil)
+            return;
+
+        if(nodes[p].left == old)
+            nodes[p].left = n;
+        else
+            nodes[p].right = n;
+    }
+
+    index_type rotate_right(index_type n)
+    {
+        index_type tmp = nodes[n].left;
+
+        nodes[n].left = nodes[tmp].right;
+        if(nodes[n].left != nil)
+            nodes[nodes[n].left].parent = n;
+
+        replace_child(nodes[n].parent, n, tmp);
+
+        nodes[tmp].parent = nodes[n].parent;
+        nodes[tmp].right  = n;
+        nodes[n].parent   = tmp;
+
+        update_props(n);
+        update_props(tmp);
+
+        return tmp;
+    }
+
+    index_type rotate_left(index_type n)
+    {
+        index_type tmp = nodes[n].right;
+
+        nodes[n].right = nodes[tmp].left;
+        if(nodes[n].right != nil)
+            nodes[nodes[n].right].parent = n;
+
+        replace_child(nodes[n].parent, n, tmp);
+
+        nodes[tmp].parent = nodes[n].parent;
+        nodes[tmp].left   = n;
+        nodes[n].parent   = tmp;
+
+        update_props(n);
+        update_props(tmp);
+
+        return tmp;
+    }
+
+    index_type lower_bound(index_type n, const key_type& k) const
+    {
+        index_type r = nil;
+        while(n != nil)
+        {
+            if(!comp.less(key(n), k))
+            {
+                r = n;
+                n = nodes[n].left;
+            }
+            else
+                n = nodes[n].right;
+        }
+
+        return r;
+    }
+
+    index_type upper_bound(index_type n, const key_type& k) const
+    {
+        index_type r = nil;
+        while(n != nil)
+        {
+            if(comp.greater(key(n), k))
+            {
+                r = n;
+                n = nodes[n].left;
+            }
+            else
+                n = nodes[n].right;
+        }
+
+        return r;
+    }
+
+    index_type find_node(const key_type& k) const
+    {
+        index_type n = lower_bound(root, k);
+
+        if(n != nil && comp.eq(key(n), k))
+            return n;
+
+        return nil;
+    }
+
+    index_type find_leaf_high(const key_type& k) const
+    {
+        index_type n = root;
+        index_type r = n;
+
+        while(n != nil)
+        {
+            r = n;
+            if(comp(k, key(n)))
+                n = nodes[n].left;
+            else
+                n = nodes[n].right;
+        }
+
+        return r;
+    }
+
+    index_type find_leaf(const_iterator h, const key_type& k) const
+    {
+        // the hint is only usable if k fits in [prior, h), otherwise fall
+        // back to the regular upper bound insertion
+        if(h == end() || comp(k, key(h.i)))
+        {
+            const_iterator prior = h;
+            if(prior == begin() || !comp(k, key((--prior).i)))
+            {
+                if(h.i != nil && nodes[h.i].left == nil)
+                    return h.i;
+                else
+                    return prior.i;
+            }
+        }
+
+        return find_leaf_high(k);
+    }
+
+    template<class CB>
+    void search(index_type n, const key_type& interval, const CB& cb) const
+    {
+        index_type stack[max_depth];
+        int        top = 0;
+
+        while(n != nil || top)
+        {
+            while(n != nil)
+            {
+                const node& c = nodes[n];
+
+                stack[top++] = n;
+
+                if(c.left != nil && comp.greater_eq(nodes[c.left].max, interval.first))
+                    n = c.left;
+                else
+                    n = nil;
+            }
+
+            n = stack[--top];
+
+            const node& c = nodes[n];
+
+            // if the current node matches, a callback returning false stops
+            if(comp.overlaps(interval, c.data.first))
+            {
+                if constexpr(interval_callback_stops<decltype(cb(n))>)
+                {
+                    if(!cb(n))
+                        return;
+                }
+                else
+                    cb(n);
+            }
+
+            if(c.right != nil && comp.greater_eq(interval.second, c.data.first.first))
+                n = c.right;
+            else
+                n = nil;
+        }
+    }
+
+    void insert(index_type n, index_type p)
+    {
+        if(comp(upper(n), lower(n)))
+        {
+            destroy_node(n);
+            throw std::range_error("Invalid interval");
+        }
+
+        nodes[n].parent = p;
+
+        if(comp.less(key(n), key(p)))
+            nodes[p].left = n;
+        else
+            nodes[p].right = n;
+
+        node_count++;
+
+        fix_after_insert(p);
+    }
+
+    index_type remove(index_type n)
+    {
+        index_type r       = next(n);
+        bool       swapped = nodes[n].left != nil && nodes[n].right != nil;
+
+        if(swapped)
+            swap_nodes(n, r);
+
+        index_type v = nodes[n].left != nil ? nodes[n].left : nodes[n].right;
+        index_type p = nodes[n].parent;
+
+        if(v != nil)
+            nodes[v].parent = p;
+
+        replace_child(p, n, v);
+
+        node_count--;
+
+        if(p != nil)
+        {
+            fix_after_erase(p);
+
+            // r took the place of n along with its max, which may still
+            // account for n
+            if(swapped)
+                update_path(r);
+        }
+        else
+            root = v;
+
+        destroy_node(n);
+
+        return r;
+    }
+
+    // Swaps the position of two nodes in the tree, indices (and so iterators)
+    // keep refering to the same elements
+    void swap_nodes(index_type a, index_type b)
+    {
+        std::swap(nodes[a].meta, nodes[b].meta);
+        std::swap(nodes[a].max , nodes[b].max);
+
+        //================================
+
+        index_type pa = nodes[a].parent;
+        index_type la = nodes[a].left;
+        index_type ra = nodes[a].right;
+
+        index_type pb = nodes[b].parent;
+        index_type lb = nodes[b].left;
+        index_type rb = nodes[b].right;
+
+        nodes[a].parent = pb == a ? b : pb;
+        nodes[a].left   = lb == a ? b : lb;
+        nodes[a].right  = rb == a ? b : rb;
+
+        nodes[b].parent = pa == b ? a : pa;
+        nodes[b].left   = la == b ? a : la;
+        nodes[b].right  = ra == b ? a : ra;
+
+        //================================
+
+        for(index_type n : {a, b})
+        {
+            index_type o = n == a ? b : a;
+            node&      c = nodes[n];
+
+            if(c.parent != nil)
+            {
+                if(nodes[c.parent].left == o)
+                    nodes[c.parent].left = n;
+                else if(nodes[c.parent].right == o)
+                    nodes[c.parent].right = n;
+            }
+
+            if(c.left != nil)
+                nodes[c.left].parent = n;
+
+            if(c.right != nil)
+                nodes[c.right].parent = n;
+        }
+
+        if(root == a)
+            root = b;
+        else if(root == b)
+            root = a;
+    }
+
+    // Restores the balance of n with a single or double rotation and
+    // returns the new root of that subtree
+    index_type balance(index_type n)
+    {
+        if(bfactor(n) < -1)
+        {
+            if(bfactor(nodes[n].left) > 0)
+                rotate_left(nodes[n].left);
+
+            n = rotate_right(n);
+        }
+        else
+        {
+            if(bfactor(nodes[n].right) < 0)
+                rotate_right(nodes[n].right);
+
+            n = rotate_left(n);
+        }
+
+        if(nodes[n].parent == nil)
+            root = n;
+
+        return n;
+    }
+
+    // Same as interval_tree: once a rotation happened the subtree has its
+    // former height back, only max may still need to climb.
+    void fix_after_insert(index_type n)
+    {
+        while(n != nil)
+        {
+            bool changed = update_props(n);
+
+            if(bfactor(n) < -1 || bfactor(n) > 1)
+            {
+                update_path(nodes[balance(n)].parent);
+                return;
+            }
+
+            if(!changed)
+                return;
+
+            n = nodes[n].parent;
+        }
+    }
+
+    void fix_after_erase(index_type n)
+    {
+        while(n != nil)
+        {
+            bool changed = update_props(n);
+
+            if(bfactor(n) < -1 || bfactor(n) > 1)
+                n = balance(n);
+            else if(!changed)
+                return;
+
+            n = nodes[n].parent;
+        }
+    }
+
+#ifdef INTERVAL_TREE_UNIT_TESTING
+public:
+    index_type __get_root() {
+        return root;
+    }
+
+    // Checks links, ordering, balance and augmented data of the whole tree
+    bool __check_invariants() const {
+        size_type c = 0;
+        return (root == nil || (nodes[root].parent == nil && __check_node(root, c))) && c == node_count;
+    }
+
+private:
+    bool __check_node(index_type n, size_type& c) const {
+        const node& x = nodes[n];
+        bound_type  m = upper(n);
+
+        ++c;
+
+        if(x.left != nil)
+        {
+            if(nodes[x.left].parent != n || comp.less(key(n), key(x.left)) || !__check_node(x.left, c))
+                return false;
+
+            m = std::max(m, nodes[x.left].max, comp);
+        }
+
+        if(x.right != nil)
+        {
+            if(nodes[x.right].parent != n || comp.less(key(x.right), key(n)) || !__check_node(x.right, c))
+                return false;
+
+            m = std::max(m, nodes[x.right].max, comp);
+        }
+
+        int l = height(x.left);
+        int r = height(x.right);
+
+        return height(n) == std::max(l, r) + 1 && bfactor(n) == r - l && r - l <= 1 && l - r <= 1 && comp.eq(m, x.max);
+    }
+#endif
+
+private:
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<node> node_allocator;
+    typedef std::allocator_traits<node_allocator>                                 node_traits;
+
+    node*          nodes      = nullptr;
+    index_type     slots      = 0;
+    index_type     used       = 0;
+    index_type     free_list  = nil;
+    index_type     root       = nil;
+    size_type      node_count = 0;
+    comparator     comp;
+    node_allocator alloc;
+};
+
+template<class K, class T, class C, class A>
+void swap(compact_interval_tree<K, T, C, A>& lhs,
+          compact_interval_tree<K, T, C, A>& rhs) noexcept(noexcept(lhs.swap(rhs)))
+{
+    lhs.swap(rhs);
+}
+
+template<class K, class T, class C, class A>
+bool operator==(const compact_interval_tree<K, T, C, A>& lhs,
+                const compact_interval_tree<K, T, C, A>& rhs)
+{
+    return lhs.size() == rhs.size() && std::equal(lhs.cbegin(), lhs.cend(), rhs.cbegin());
+}
+
+template<class K, class T, class C, class A>
+bool operator!=(const compact_interval_tree<K, T, C, A>& lhs,
+                const compact_interval_tree<K, T, C, A>& rhs)
+{
+    return !(lhs == rhs);
+}
+
+#endif // COMPACT_INTERVAL_TREE_H
@@ -0,0 +1,601 @@
+#ifndef FROZEN_INTERVAL_TREE_H
+#define FROZEN_INTERVAL_TREE_H
+
+#include <cstdint>
+
+#include <sorted_interval_array.h>
+
+#if !defined(INTERVAL_TREE_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define INTERVAL_TREE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// ====== MATCH KERNELS ========================================================
+// Overlap test of a full bucket of bounds against [s, e], one bit per element.
+// lower <= e is tested as !(lower > e) and upper >= s as !(s > upper), like
+// the comparator does. The instruction set is picked at runtime, define
+// INTERVAL_TREE_NO_SIMD to always use the generic loop.
+enum class interval_simd_level { scalar, sse, avx2 };
+
+#ifdef INTERVAL_TREE_UNIT_TESTING
+// Level forced by the tests, so that every kernel the host supports is checked
+// against the others. Ignored when above what the CPU supports.
+inline std::optional<interval_simd_level> __interval_simd_override;
+#endif
+
+inline interval_simd_level interval_simd_detect() noexcept
+{
+#ifdef INTERVAL_TREE_X86_SIMD
+    static const interval_simd_level level = __builtin_cpu_supports("avx2")   ? interval_simd_level::avx2 :
+                                             __builtin_cpu_supports("sse4.2") ? interval_simd_level::sse  :
+                                                                                interval_simd_level::scalar;
+#else
+    const interval_simd_level level = interval_simd_level::scalar;
+#endif
+
+#ifdef INTERVAL_TREE_UNIT_TESTING
+    if(__interval_simd_override && *__interval_simd_override <= level)
+        return *__interval_simd_override;
+#endif
+
+    return level;
+}
+
+#ifdef INTERVAL_TREE_X86_SIMD
+__attribute__((target("avx2")))
+inline std::uint32_t interval_match_avx2(const std::int64_t* lo, const std::int64_t* up, std::int64_t s, std::int64_t e)
+{
+    __m256i vs = _mm256_set1_epi64x(s);
+    __m256i ve = _mm256_set1_epi64x(e);
+    std::uint32_t m = 0;
+
+    for(int k = 0; k < 16; k += 4)
+    {
+        __m256i l   = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lo + k));
+        __m256i u   = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(up + k));
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi64(l, ve), _mm256_cmpgt_epi64(vs, u));
+        m |= std::uint32_t(~_mm256_movemask_pd(_mm256_castsi256_pd(out)) & 0xF) << k;
+    }
+
+    return m;
+}
+
+__attribute__((target("avx2")))
+inline std::uint32_t interval_match_avx2(const std::int32_t* lo, const std::int32_t* up, std::int32_t s, std::int32_t e)
+{
+    __m256i vs = _mm256_set1_epi32(s);
+    __m256i ve = _mm256_set1_epi32(e);
+    std::uint32_t m = 0;
+
+    for(int k = 0; k < 16; k += 8)
+    {
+        __m256i l   = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lo + k));
+        __m256i u   = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(up + k));
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(l, ve), _mm256_cmpgt_epi32(vs, u));
+        m |= std::uint32_t(~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xFF) << k;
+    }
+
+    return m;
+}
+
+__attribute__((target("avx2")))
+inline std::uint32_t interval_match_avx2(const double* lo, const double* up, double s, double e)
+{
+    __m256d vs = _mm256_set1_pd(s);
+    __m256d ve = _mm256_set1_pd(e);
+    std::uint32_t m = 0;
+
+    for(int k = 0; k < 16; k += 4)
+    {
+        __m256d in = _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(lo + k), ve, _CMP_NGT_UQ),
+                                   _mm256_cmp_pd(vs, _mm256_loadu_pd(up + k), _CMP_NGT_UQ));
+        m |= std::uint32_t(_mm256_movemask_pd(in)) << k;
+    }
+
+    return m;
+}
+
+__attribute__((target("avx2")))
+inline std::uint32_t interval_match_avx2(const float* lo, const float* up, float s, float e)
+{
+    __m256 vs = _mm256_set1_ps(s);
+    __m256 ve = _mm256_set1_ps(e);
+    std::uint32_t m = 0;
+
+    for(int k = 0; k < 16; k += 8)
+    {
+        __m256 in = _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(lo + k), ve, _CMP_NGT_UQ),
+                                  _mm256_cmp_ps(vs, _mm256_loadu_ps(up + k), _CMP_NGT_UQ));
+        m |= std::uint32_t(_mm256_movemask_ps(in)) << k;
+    }
+
+    return m;
+}
+
+__attribute__((target("sse4.2")))
+inline std::uint32_t interval_match_sse(const std::int64_t* lo, const std::int64_t* up, std::int64_t s, std::int64_t e)
+{
+    __m128i vs = _mm_set1_epi64x(s);
+    __m128i ve = _mm_set1_epi64x(e);
+    std::uint32_t m = 0;
+
+    for(int k = 0; k < 16; k += 2)
+    {
+        __m128i l   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo + k));
+        __m128i u   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + k));
+        __m128i out = _mm_or_si128(_mm_cmpgt_epi64(l, ve), _mm_cmpgt_epi64(vs, u));
+        m |= std::uint32_t(~_mm_movemask_pd(_mm_castsi128_pd(out)) & 0x3) << k;
+    }
+
+    return m;
+}
+
+__attribute__((target("sse4.2")))
+inline std::uint32_t interval_match_sse(const std::int32_t* lo, const std::int32_t* up, std::int32_t s, std::int32_t e)
+{
+    __m128i vs = _mm_set1_epi32(s);
+    __m128i ve = _mm_set1_epi32(e);
+    std::uint32_t m = 0;
+
+    for(int k = 0; k < 16; k += 4)
+    {
+        __m128i l   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo + k));
+        __m128i u   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + k));
+        __m128i out = _mm_or_si128(_mm_cmpgt_epi32(l, ve), _mm_cmpgt_epi32(vs, u));
+        m |= std::uint32_t(~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xF) << k;
+    }
+
+    return m;
+}
+
+__attribute__((target("sse4.2")))
+inline std::uint32_t interval_match_sse(const double* lo, const double* up, double s, double e)
+{
+    __m128d vs = _mm_set1_pd(s);
+    __m128d ve = _mm_set1_pd(e);
+    std::uint32_t m = 0;
+
+    for(int k = 0; k < 16; k += 2)
+    {
+        __m128d in = _mm_and_pd(_mm_cmpngt_pd(_mm_loadu_pd(lo + k), ve),
+                                _mm_cmpngt_pd(vs, _mm_loadu_pd(up + k)));
+        m |= std::uint32_t(_mm_movemask_pd(in)) << k;
+    }
+
+    return m;
+}
+
+__attribute__((target("sse4.2")))
+inline std::uint32_t interval_match_sse(const float* lo, const float* up, float s, float e)
+{
+    __m128 vs = _mm_set1_ps(s);
+    __m128 ve = _mm_set1_ps(e);
+    std::uint32_t m = 0;
+
+    for(int k = 0; k < 16; k += 4)
+    {
+        __m128 in = _mm_and_ps(_mm_cmpngt_ps(_mm_loadu_ps(lo + k), ve),
+                               _mm_cmpngt_ps(vs, _mm_loadu_ps(up + k)));
+        m |= std::uint32_t(_mm_movemask_ps(in)) << k;
+    }
+
+    return m;
+}
+#endif
+
+
+
+// Immutable interval index built once from an interval_tree or a range. The
+// elements are kept in key order in flat arrays, the bounds apart from the
+// values, and cut in buckets of 16. The buckets form an implicit search tree
+// in Eytzinger order (children of i at 2i+1 and 2i+2, the top levels share
+// the first cache lines) where each node only holds the max of its subtree
+// and where its bucket starts. A visited bucket is tested as a whole, with
+// SIMD for arithmetic keys.
+template<
+    typename Key,
+    typename T,
+    typename Compare = std::less<Key>,
+    typename Allocator = std::allocator<std::pair<std::pair<Key, Key>, T>>
+>
+class frozen_interval_tree : public sorted_interval_array<frozen_interval_tree<Key, T, Compare, Allocator>, Key, T, Compare, Allocator>
+{
+    typedef sorted_interval_array<frozen_interval_tree, Key, T, Compare, Allocator> base;
+
+public:
+    // ====== TYPEDEFS =========================================================
+    using typename base::bound_type;
+    using typename base::key_type;
+    using typename base::size_type;
+    using typename base::value_type;
+    using typename base::const_iterator;
+
+    // Number of elements tested at once, one bit each in a match mask
+    static constexpr size_type bucket_size = 16;
+
+
+
+private:
+    // ====== NODE =============================================================
+    static constexpr size_type nil = std::numeric_limits<size_type>::max();
+
+    // The max of the subtree, then what tells whether the bucket itself is
+    // worth testing and whether the walk can go on after it
+    struct node
+    {
+        bound_type max;
+        bound_type bucket_max;
+        bound_type last_lower;
+        size_type  first;
+    };
+
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<node>       node_allocator;
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<bound_type> bound_allocator;
+
+    // Keys the match kernels handle, when ordered by operator<: signed
+    // integers of 32 or 64 bits whatever their name (long, long long...),
+    // float and double. They are passed to the kernels as simd_type.
+    static constexpr bool simd_integer = std::is_integral<Key>::value && std::is_signed<Key>::value &&
+                                         (sizeof(Key) == 4 || sizeof(Key) == 8);
+    static constexpr bool simd_keys    = std::is_same<Compare, std::less<Key>>::value &&
+                                         (simd_integer || std::is_same<Key, float>::value || std::is_same<Key, double>::value);
+
+    typedef typename std::conditional<
+        simd_integer,
+        typename std::conditional<sizeof(Key) == 4, std::int32_t, std::int64_t>::type,
+        Key
+    >::type simd_type;
+
+public:
+    // ====== CONSTRUCTORS =====================================================
+    frozen_interval_tree() = default;
+
+    explicit frozen_interval_tree(const Allocator& alloc) : base(alloc), nodes(alloc), lowers(alloc), uppers(alloc) {}
+
+    // Copies the elements of tree
+    template<class A, bool S>
+    explicit frozen_interval_tree(const interval_tree<Key, T, Compare, A, S>& tree, const Allocator& alloc = Allocator()) :
+        base(tree, alloc),
+        nodes(alloc),
+        lowers(alloc),
+        uppers(alloc)
+    {
+        build();
+    }
+
+    // Moves the elements out of tree, tree is left empty
+    template<class A, bool S>
+    explicit frozen_interval_tree(interval_tree<Key, T, Compare, A, S>&& tree, const Allocator& alloc = Allocator()) :
+        base(std::move(tree), alloc),
+        nodes(alloc),
+        lowers(alloc),
+        uppers(alloc)
+    {
+        build();
+    }
+
+    template<class InputIt>
+    frozen_interval_tree(InputIt first, InputIt last, const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+        base(first, last, comp, alloc),
+        nodes(alloc),
+        lowers(alloc),
+        uppers(alloc)
+    {
+        build();
+    }
+
+    // The range is already in key order, it isn't sorted again
+    template<class InputIt>
+    frozen_interval_tree(sorted_input_t, InputIt first, InputIt last, const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+        base(sorted_input, first, last, comp, alloc),
+        nodes(alloc),
+        lowers(alloc),
+        uppers(alloc)
+    {
+        build();
+    }
+
+    frozen_interval_tree(std::initializer_list<value_type> ilist, const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+        frozen_interval_tree(ilist.begin(), ilist.end(), comp, alloc)
+    {}
+
+
+
+    // ====== CAPACITY =========================================================
+    size_type max_size() const noexcept
+    {
+        return std::min(lowers.max_size(), values.max_size());
+    }
+
+
+
+    // ====== MODIFIERS ========================================================
+    void swap(frozen_interval_tree& other) noexcept(std::is_nothrow_swappable<Compare>::value)
+    {
+        this->swap_values(other);
+        nodes.swap(other.nodes);
+        lowers.swap(other.lowers);
+        uppers.swap(other.uppers);
+    }
+
+
+
+    // ====== LOOKUP ===========================================================
+    using base::in;
+
+    template<class CB>
+    void in(key_type interval, CB callback) const
+    {
+        in_blocks(interval, [&](const_iterator first, std::uint32_t mask)
+        {
+            for(; mask; mask &= mask - 1)
+            {
+                const_iterator it(this, first.i + count_trailing_zeros(mask));
+
+                if constexpr(interval_callback_stops<decltype(callback(it))>)
+                {
+                    if(!callback(it))
+                        return false;
+                }
+                else
+                    callback(it);
+            }
+
+            return true;
+        });
+    }
+
+    // Match masks: callback receives the first element of a bucket holding
+    // matches and a mask where bit j is set if the element first + j
+    // matches, bucket by bucket in key order. A callback returning bool stops
+    // the search on false.
+    template<class CB>
+    void at_blocks(const Key& point, CB callback) const { in_blocks({point, point}, callback); }
+
+    template<class CB>
+    void in_blocks(const key_type& interval, CB callback) const
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        search(interval, [&](size_type first, std::uint32_t mask){ return callback(const_iterator(this, first), mask); });
+    }
+
+
+
+    // ====== PRIVATE ==========================================================
+private:
+    using base::comp;
+    using base::values;
+
+    static int count_trailing_zeros(std::uint32_t mask)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctz(mask);
+#else
+        int n = 0;
+
+        while(!(mask & 1))
+        {
+            mask >>= 1;
+            n++;
+        }
+
+        return n;
+#endif
+    }
+
+    static size_type leftest(size_type i, size_type n)
+    {
+        while(2 * i + 1 < n)
+            i = 2 * i + 1;
+
+        return i;
+    }
+
+    // In-order successor in the implicit tree: the leftest of the right
+    // subtree, or the first ancestor reached from its left subtree
+    static size_type next(size_type i, size_type n)
+    {
+        if(2 * i + 2 < n)
+            return leftest(2 * i + 2, n);
+
+        while(i && i % 2 == 0)
+            i = (i - 1) / 2;
+
+        return i ? (i - 1) / 2 : nil;
+    }
+
+    // values is in key order. Splits the bounds out of it, gives the buckets
+    // their place in the implicit tree through its in-order walk, and
+    // computes the max bottom up.
+    void build()
+    {
+        size_type n = values.size();
+        size_type b = (n + bucket_size - 1) / bucket_size;
+
+        lowers.reserve(n);
+        uppers.reserve(n);
+
+        for(auto& v : values)
+        {
+            lowers.push_back(v.first.first);
+            uppers.push_back(v.first.second);
+        }
+
+        std::vector<size_type> first(b);
+
+        size_type r = 0;
+        for(size_type i = b ? leftest(0, b) : nil; i != nil; i = next(i, b))
+            first[i] = bucket_size * r++;
+
+        nodes.reserve(b);
+
+        for(size_type i = 0; i < b; ++i)
+        {
+            size_type end = std::min(n, first[i] + bucket_size);
+            auto      m   = std::max_element(uppers.begin() + first[i], uppers.begin() + end, comp);
+
+            nodes.push_back({*m, *m, lowers[end - 1], first[i]});
+        }
+
+        for(size_type i = b; i-- > 0;)
+        {
+            if(2 * i + 1 < b)
+                nodes[i].max = std::max(nodes[i].max, nodes[2 * i + 1].max, comp);
+
+            if(2 * i + 2 < b)
+                nodes[i].max = std::max(nodes[i].max, nodes[2 * i + 2].max, comp);
+        }
+    }
+
+    // Overlap mask of the count elements from first
+    std::uint32_t match(size_type first, size_type count, const key_type& interval, interval_simd_level simd) const
+    {
+        const bound_type* lo = lowers.data() + first;
+        const bound_type* up = uppers.data() + first;
+
+#ifdef INTERVAL_TREE_X86_SIMD
+        if constexpr(simd_keys)
+        {
+            if(count == bucket_size)
+            {
+                // The kernels only read the bounds through vector loads
+                const simd_type* vlo = reinterpret_cast<const simd_type*>(lo);
+                const simd_type* vup = reinterpret_cast<const simd_type*>(up);
+                simd_type        s   = static_cast<simd_type>(interval.first);
+                simd_type        e   = static_cast<simd_type>(interval.second);
+
+                if(simd == interval_simd_level::avx2)
+                    return interval_match_avx2(vlo, vup, s, e);
+
+                if(simd == interval_simd_level::sse)
+                    return interval_match_sse(vlo, vup, s, e);
+            }
+        }
+#else
+        (void)simd;
+#endif
+
+        std::uint32_t m = 0;
+
+        for(size_type j = 0; j < count; ++j)
+        {
+            if(comp.less_eq(lo[j], interval.second) && comp.greater_eq(up[j], interval.first))
+                m |= std::uint32_t(1) << j;
+        }
+
+        return m;
+    }
+
+    // In-order walk of the buckets, pruned with max on the left and the key
+    // order on the right. Only the buckets reaching interval are tested, and
+    // the walk ends at the first bucket whose last lower bound is past the
+    // end of interval. The implicit tree is complete so the stack never
+    // holds more than log2(size) positions.
+    template<class CB>
+    void search(const key_type& interval, const CB& cb) const
+    {
+        const size_type     b    = nodes.size();
+        const size_type     n    = values.size();
+        const node*         t    = nodes.data();
+        interval_simd_level simd = interval_simd_detect();
+
+        size_type stack[std::numeric_limits<size_type>::digits];
+        int       top = 0;
+        size_type i   = b ? 0 : nil;
+
+        while(i != nil || top)
+        {
+            while(i != nil)
+            {
+                stack[top++] = i;
+
+                size_type l = 2 * i + 1;
+                i = l < b && comp.greater_eq(t[l].max, interval.first) ? l : nil;
+            }
+
+            i = stack[--top];
+
+            if(comp.greater_eq(t[i].bucket_max, interval.first))
+            {
+                size_type first = t[i].first;
+                size_type count = std::min(bucket_size, n - first);
+
+                if(std::uint32_t mask = match(first, count, interval, simd))
+                {
+                    if constexpr(interval_callback_stops<decltype(cb(first, mask))>)
+                    {
+                        if(!cb(first, mask))
+                            return;
+                    }
+                    else
+                        cb(first, mask);
+                }
+            }
+
+            // the following buckets start after this one ends
+            if(comp.greater(t[i].last_lower, interval.second))
+                return;
+
+            size_type r = 2 * i + 2;
+            i = r < b && comp.greater_eq(t[r].max, interval.first) ? r : nil;
+        }
+    }
+
+#ifdef INTERVAL_TREE_UNIT_TESTING
+public:
+    // Checks the order of the elements, the bounds and the max of every
+    // subtree
+    bool __check_invariants() const {
+        size_type b = nodes.size();
+
+        if(b != (values.size() + bucket_size - 1) / bucket_size)
+            return false;
+
+        for(size_type i = 0; i < values.size(); ++i)
+        {
+            if(comp.neq(lowers[i], values[i].first.first) || comp.neq(uppers[i], values[i].first.second))
+                return false;
+        }
+
+        for(size_type i = 0; i < b; ++i)
+        {
+            size_type  end = std::min(values.size(), nodes[i].first + bucket_size);
+            bound_type m   = *std::max_element(uppers.begin() + nodes[i].first, uppers.begin() + end, comp);
+
+            if(comp.neq(m, nodes[i].bucket_max))
+                return false;
+
+            for(size_type c : {2 * i + 1, 2 * i + 2})
+            {
+                if(c < b)
+                {
+                    m = std::max(m, nodes[c].max, comp);
+
+                    if((c == 2 * i + 1) != (nodes[c].first < nodes[i].first))
+                        return false;
+                }
+            }
+
+            if(comp.neq(m, nodes[i].max) || comp.neq(lowers[end - 1], nodes[i].last_lower))
+                return false;
+        }
+
+        return std::is_sorted(this->begin(), this->end(), comp);
+    }
+#endif
+
+    std::vector<node, node_allocator>          nodes;
+    std::vector<bound_type, bound_allocator>   lowers;
+    std::vector<bound_type, bound_allocator>   uppers;
+};
+
+template<class K, class T, class C, class A>
+void swap(frozen_interval_tree<K, T, C, A>& lhs,
+          frozen_interval_tree<K, T, C, A>& rhs) noexcept(noexcept(lhs.swap(rhs)))
+{
+    lhs.swap(rhs);
+}
+
+#endif // FROZEN_INTERVAL_TREE_H
@@ -0,0 +1,275 @@
+#ifndef IMPLICIT_INTERVAL_TREE_H
+#define IMPLICIT_INTERVAL_TREE_H
+
+#include <sorted_interval_array.h>
+
+// Immutable interval tree stored as a plain array in key order, in the style
+// of cgranges. The tree is implicit in the positions: the nodes of level k
+// are at the positions whose k lowest bits are set, a node x of level k has
+// its children at x -/+ 2^(k-1) and the root is at 2^K - 1. Along the values
+// only the max of each subtree is stored, in a parallel array. Positions
+// past the end stand for imaginary nodes of the last, incomplete, subtree.
+template<
+    typename Key,
+    typename T,
+    typename Compare = std::less<Key>,
+    typename Allocator = std::allocator<std::pair<std::pair<Key, Key>, T>>
+>
+class implicit_interval_tree : public sorted_interval_array<implicit_interval_tree<Key, T, Compare, Allocator>, Key, T, Compare, Allocator>
+{
+    typedef sorted_interval_array<implicit_interval_tree, Key, T, Compare, Allocator> base;
+
+public:
+    // ====== TYPEDEFS =========================================================
+    using typename base::bound_type;
+    using typename base::key_type;
+    using typename base::size_type;
+    using typename base::value_type;
+    using typename base::const_iterator;
+
+
+
+private:
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<bound_type> bound_allocator;
+
+public:
+    // ====== CONSTRUCTORS =====================================================
+    implicit_interval_tree() = default;
+
+    explicit implicit_interval_tree(const Allocator& alloc) : base(alloc), maxs(alloc) {}
+
+    // Copies the elements of tree
+    template<class A, bool S>
+    explicit implicit_interval_tree(const interval_tree<Key, T, Compare, A, S>& tree, const Allocator& alloc = Allocator()) :
+        base(tree, alloc),
+        maxs(alloc)
+    {
+        build();
+    }
+
+    // Moves the elements out of tree, tree is left empty
+    template<class A, bool S>
+    explicit implicit_interval_tree(interval_tree<Key, T, Compare, A, S>&& tree, const Allocator& alloc = Allocator()) :
+        base(std::move(tree), alloc),
+        maxs(alloc)
+    {
+        build();
+    }
+
+    template<class InputIt>
+    implicit_interval_tree(InputIt first, InputIt last, const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+        base(first, last, comp, alloc),
+        maxs(alloc)
+    {
+        build();
+    }
+
+    // The range is already in key order, it isn't sorted again
+    template<class InputIt>
+    implicit_interval_tree(sorted_input_t, InputIt first, InputIt last, const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+        base(sorted_input, first, last, comp, alloc),
+        maxs(alloc)
+    {
+        build();
+    }
+
+    implicit_interval_tree(std::initializer_list<value_type> ilist, const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+        implicit_interval_tree(ilist.begin(), ilist.end(), comp, alloc)
+    {}
+
+
+
+    // ====== CAPACITY =========================================================
+    size_type max_size() const noexcept
+    {
+        return std::min(maxs.max_size(), values.max_size());
+    }
+
+
+
+    // ====== MODIFIERS ========================================================
+    void swap(implicit_interval_tree& other) noexcept(std::is_nothrow_swappable<Compare>::value)
+    {
+        this->swap_values(other);
+        maxs.swap(other.maxs);
+    }
+
+
+
+    // ====== LOOKUP ===========================================================
+    using base::in;
+
+    template<class CB>
+    void in(key_type interval, CB callback) const
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        search(interval, [&](size_type i){ return callback(const_iterator(this, i)); });
+    }
+
+
+
+    // ====== PRIVATE ==========================================================
+private:
+    using base::comp;
+    using base::values;
+
+    // Level of the root, the highest k with 2^k <= size
+    size_type root_level() const
+    {
+        size_type k = 0;
+
+        while((size_type(2) << k) <= values.size())
+            k++;
+
+        return k;
+    }
+
+    // values is in key order. One pass per level computes the max of its
+    // nodes from their children. The right child of a node may be past the
+    // end, its subtree then holds the last elements only: last is the max of
+    // the deepest real node on the right edge, carried up level by level.
+    void build()
+    {
+        size_type n = values.size();
+
+        maxs.reserve(n);
+
+        for(auto& v : values)
+            maxs.push_back(v.first.second);
+
+        if(!n)
+            return;
+
+        size_type  last_i = (n - 1) & ~size_type(1);
+        bound_type last   = maxs[last_i];
+
+        for(size_type k = 1; (size_type(1) << k) <= n; ++k)
+        {
+            size_type x    = size_type(1) << (k - 1);
+            size_type step = x << 2;
+
+            for(size_type i = (x << 1) - 1; i < n; i += step)
+            {
+                bound_type m = std::max(maxs[i], maxs[i - x], comp);
+                maxs[i] = std::max(m, i + x < n ? maxs[i + x] : last, comp);
+            }
+
+            last_i = (last_i >> k & 1) ? last_i - x : last_i + x;
+
+            if(last_i < n && comp.greater(maxs[last_i], last))
+                last = maxs[last_i];
+        }
+    }
+
+    // In-order walk from the root. A frame is a node, its level and whether
+    // its left subtree was already looked at. The left subtree is skipped if
+    // it doesn't reach interval, and the walk stops at the first node
+    // starting after it. Subtrees of less than 16 elements are scanned.
+    template<class CB>
+    void search(const key_type& interval, const CB& cb) const
+    {
+        struct frame { size_type x, k; bool left_done; };
+
+        const size_type   n = values.size();
+        const value_type* v = values.data();
+        const bound_type* m = maxs.data();
+
+        if(!n)
+            return;
+
+        auto emit = [&](size_type i)
+        {
+            if constexpr(interval_callback_stops<decltype(cb(i))>)
+                return bool(cb(i));
+            else
+            {
+                cb(i);
+                return true;
+            }
+        };
+
+        frame stack[std::numeric_limits<size_type>::digits + 1];
+        int   top = 0;
+
+        size_type k = root_level();
+        stack[top++] = {(size_type(1) << k) - 1, k, false};
+
+        while(top)
+        {
+            frame f = stack[--top];
+
+            if(f.k <= 3)
+            {
+                size_type i   = f.x >> f.k << f.k;
+                size_type end = std::min(n, i + (size_type(2) << f.k) - 1);
+
+                for(; i < end && comp.less_eq(v[i].first.first, interval.second); ++i)
+                {
+                    if(comp.greater_eq(v[i].first.second, interval.first) && !emit(i))
+                        return;
+                }
+            }
+            else if(!f.left_done)
+            {
+                size_type y = f.x - (size_type(1) << (f.k - 1));
+
+                stack[top++] = {f.x, f.k, true};
+
+                if(y >= n || comp.greater_eq(m[y], interval.first))
+                    stack[top++] = {y, f.k - 1, false};
+            }
+            else if(f.x < n && comp.less_eq(v[f.x].first.first, interval.second))
+            {
+                if(comp.greater_eq(v[f.x].first.second, interval.first) && !emit(f.x))
+                    return;
+
+                stack[top++] = {f.x + (size_type(1) << (f.k - 1)), f.k - 1, false};
+            }
+        }
+    }
+
+#ifdef INTERVAL_TREE_UNIT_TESTING
+public:
+    // Checks the order of the elements and the max of every real node
+    // against its subtree
+    bool __check_invariants() const {
+        size_type n = values.size();
+
+        if(maxs.size() != n)
+            return false;
+
+        for(size_type i = 0; i < n; ++i)
+        {
+            size_type k = 0;
+
+            while(i >> k & 1)
+                k++;
+
+            size_type  first = i >> k << k;
+            size_type  last  = std::min(n, first + (size_type(2) << k) - 1);
+            bound_type e     = values[first].first.second;
+
+            for(size_type j = first; j < last; ++j)
+                e = std::max(e, values[j].first.second, comp);
+
+            if(comp.neq(e, maxs[i]))
+                return false;
+        }
+
+        return std::is_sorted(this->begin(), this->end(), comp);
+    }
+#endif
+
+    std::vector<bound_type, bound_allocator> maxs;
+};
+
+template<class K, class T, class C, class A>
+void swap(implicit_interval_tree<K, T, C, A>& lhs,
+          implicit_interval_tree<K, T, C, A>& rhs) noexcept(noexcept(lhs.swap(rhs)))
+{
+    lhs.swap(rhs);
+}
+
+#endif // IMPLICIT_INTERVAL_TREE_H
@@ -2,15 +2,355 @@
 #define INTERVAL_TREE_H
 
 #include <algorithm>
+#include <iterator>
 #include <type_traits>
 #include <vector>
 #include <utility>
 #include <stdexcept>
+#include <memory>
+#include <limits>
+#include <optional>
+
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+
+#if __has_include(<ranges>)
+#include <ranges>
+#endif
+
+// ====== KEY COMPARE ==========================================================
+// Compares bounds, intervals (lexicographically) and values (by interval) with
+// a single user supplied bound comparison. Shared by all the interval
+// containers.
+template<class Key, class T, class Compare>
+class interval_comparator
+{
+public:
+    typedef Key                              bound_type;
+    typedef std::pair<Key, Key>              key_type;
+    typedef std::pair<key_type, T>           value_type;
+
+    interval_comparator() = default;
+    interval_comparator(Compare c) : comp(c) {}
+
+    inline bool operator()(const bound_type& lhs, const bound_type& rhs) const { return less(lhs, rhs); }
+    inline bool operator()(const key_type&   lhs, const key_type&   rhs) const { return less(lhs, rhs); }
+    inline bool operator()(const value_type& lhs, const value_type& rhs) const { return less(lhs, rhs); }
+
+    inline bool less(const bound_type& lhs, const bound_type& rhs) const { return comp(lhs, rhs); }
+    inline bool less(const key_type& lhs, const key_type& rhs) const
+    {
+        return less(lhs.first, rhs.first) || (eq(rhs.first, lhs.first) && less(lhs.second, rhs.second));
+    }
+    inline bool less(const value_type& lhs, const value_type& rhs) const { return less(lhs.first, rhs.first); }
+
+    inline bool greater(const bound_type& lhs, const bound_type& rhs) const { return less(rhs, lhs); }
+    inline bool greater(const key_type&   lhs, const key_type&   rhs) const { return less(rhs, lhs); }
+    inline bool greater(const value_type& lhs, const value_type& rhs) const { return less(rhs, lhs); }
+
+    inline bool less_eq(const bound_type& lhs, const bound_type& rhs) const { return !greater(lhs, rhs); }
+    inline bool less_eq(const key_type&   lhs, const key_type&   rhs) const { return !greater(lhs, rhs); }
+    inline bool less_eq(const value_type& lhs, const value_type& rhs) const { return !greater(lhs, rhs); }
+
+    inline bool greater_eq(const bound_type& lhs, const bound_type& rhs) const { return !less(lhs, rhs); }
+    inline bool greater_eq(const key_type&   lhs, const key_type&   rhs) const { return !less(lhs, rhs); }
+    inline bool greater_eq(const value_type& lhs, const value_type& rhs) const { return !less(lhs, rhs); }
+
+    inline bool eq(const bound_type& lhs, const bound_type& rhs) const { return !less(lhs, rhs) && !greater(lhs, rhs); }
+    inline bool eq(const key_type&   lhs, const key_type&   rhs) const { return !less(lhs, rhs) && !greater(lhs, rhs); }
+    inline bool eq(const value_type& lhs, const value_type& rhs) const { return !less(lhs, rhs) && !greater(lhs, rhs); }
+
+    inline bool neq(const bound_type& lhs, const bound_type& rhs) const { return !eq(lhs, rhs); }
+    inline bool neq(const key_type&   lhs, const key_type&   rhs) const { return !eq(lhs, rhs); }
+    inline bool neq(const value_type& lhs, const value_type& rhs) const { return !eq(lhs, rhs); }
+
+    inline bool overlaps(const key_type& a, const key_type& b) const
+    {
+        return less_eq(a.first, b.second) && greater_eq(a.second, b.first);
+    }
+
+    inline bool encloses(const key_type& a, const key_type& b) const
+    {
+        return less_eq(a.first, b.first) && greater_eq(a.second, b.second);
+    }
+
+protected:
+    Compare comp;
+};
+
+
+
+// ====== SORTED INPUT TAG =====================================================
+// Tells a constructor or insert() that the range is already sorted by
+// interval, the sort (or the check for it) is then skipped.
+struct sorted_input_t { explicit sorted_input_t() = default; };
+inline constexpr sorted_input_t sorted_input{};
+
+
+// Whether a query callback returning R can stop the query: any non void
+// result convertible to bool does, false (or its equivalent) stops it.
+template<class R>
+inline constexpr bool interval_callback_stops = !std::is_void<R>::value && std::is_convertible<R, bool>::value;
+
+
+
+// ====== NODE POOL ============================================================
+// Slab allocator for tree nodes. Blocks of a single size (fixed by the first
+// single object allocation) are carved out of slabs and recycled through a
+// free list. Copies of an allocator share the same pool, a container copy gets
+// a fresh one. The pool is not synchronized.
+class interval_tree_node_pool
+{
+public:
+    interval_tree_node_pool() = default;
+    interval_tree_node_pool(const interval_tree_node_pool&) = delete;
+    interval_tree_node_pool& operator=(const interval_tree_node_pool&) = delete;
+
+    ~interval_tree_node_pool()
+    {
+        for(auto& s : slabs)
+            ::operator delete(s.first, std::align_val_t(block_align));
+    }
+
+    bool accepts(std::size_t size, std::size_t align) const noexcept
+    {
+        return block_size == 0 ? align <= alignof(std::max_align_t)
+                               : round_up(size, block_align) == block_size && align <= block_align;
+    }
+
+    void* allocate(std::size_t size, std::size_t align)
+    {
+        if(block_size == 0)
+            init(size, align);
+
+        if(!free_list)
+            grow(next_slab);
+
+        free_block* b = free_list;
+        free_list = b->next;
+        --free_count;
+
+        return b;
+    }
+
+    void deallocate(void* p) noexcept
+    {
+        free_block* b = static_cast<free_block*>(p);
+        b->next   = free_list;
+        free_list = b;
+        ++free_count;
+    }
+
+    void reserve(std::size_t n, std::size_t size, std::size_t align)
+    {
+        if(block_size == 0)
+            init(size, align);
+
+        if(free_count < n)
+            grow(n - free_count);
+    }
+
+    void shrink_to_fit()
+    {
+        if(slabs.empty())
+            return;
+
+        std::sort(slabs.begin(), slabs.end());
+
+        // count the free blocks of each slab
+        std::vector<std::size_t> counts(slabs.size(), 0);
+        for(free_block* b = free_list; b; b = b->next)
+            ++counts[slab_of(b)];
+
+        free_block*  kept  = nullptr;
+        free_block** tail  = &kept;
+        for(free_block* b = free_list; b;)
+        {
+            free_block* next = b->next;
+            std::size_t i    = slab_of(b);
+
+            if(counts[i] != slabs[i].second)
+            {
+                *tail = b;
+                tail  = &b->next;
+            }
+            else
+                --free_count;
+
+            b = next;
+        }
+        *tail     = nullptr;
+        free_list = kept;
+
+        std::size_t j = 0;
+        for(std::size_t i = 0; i < slabs.size(); ++i)
+        {
+            if(counts[i] == slabs[i].second)
+            {
+                total -= slabs[i].second;
+                ::operator delete(slabs[i].first, std::align_val_t(block_align));
+            }
+            else
+                slabs[j++] = slabs[i];
+        }
+        slabs.resize(j);
+
+        next_slab = first_slab;
+    }
+
+    std::size_t capacity() const noexcept { return total; }
+    std::size_t available() const noexcept { return free_count; }
+
+private:
+    struct free_block { free_block* next; };
+
+    static constexpr std::size_t first_slab = 32;
+    static constexpr std::size_t max_slab   = 4096;
+
+    static std::size_t round_up(std::size_t v, std::size_t a) noexcept
+    {
+        return (v + a - 1) / a * a;
+    }
+
+    void init(std::size_t size, std::size_t align)
+    {
+        block_align = std::max(align, alignof(free_block));
+        block_size  = round_up(std::max(size, sizeof(free_block)), block_align);
+    }
+
+    void grow(std::size_t n)
+    {
+        char* slab = static_cast<char*>(::operator new(n * block_size, std::align_val_t(block_align)));
+
+        try
+        {
+            slabs.emplace_back(slab, n);
+        }
+        catch(...)
+        {
+            ::operator delete(slab, std::align_val_t(block_align));
+            throw;
+        }
+
+        // thread the new blocks in address order in front of the free list
+        for(std::size_t i = n; i > 0; --i)
+            deallocate(slab + (i - 1) * block_size);
+
+        total    += n;
+        next_slab = std::min(next_slab * 2, max_slab);
+    }
+
+    std::size_t slab_of(const void* p) const
+    {
+        const char* c = static_cast<const char*>(p);
+        auto it = std::upper_bound(slabs.begin(), slabs.end(), c,
+                                   [](const char* v, const std::pair<char*, std::size_t>& s) { return v < s.first; });
+        return std::size_t(it - slabs.begin()) - 1;
+    }
+
+    std::vector<std::pair<char*, std::size_t>> slabs;
+
+    free_block* free_list   = nullptr;
+    std::size_t free_count  = 0;
+    std::size_t total       = 0;
+    std::size_t block_size  = 0;
+    std::size_t block_align = alignof(std::max_align_t);
+    std::size_t next_slab   = first_slab;
+};
+
+template<class T>
+class interval_tree_pool_allocator
+{
+    template<class U> friend class interval_tree_pool_allocator;
+
+public:
+    typedef T              value_type;
+    typedef std::size_t    size_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
+
+    interval_tree_pool_allocator() : pool(std::make_shared<interval_tree_node_pool>()) {}
+
+    // Copies and moves alike share the pool, a moved from allocator (and the
+    // container holding it) must remain usable
+    interval_tree_pool_allocator(const interval_tree_pool_allocator& other) noexcept : pool(other.pool) {}
+
+    interval_tree_pool_allocator& operator=(const interval_tree_pool_allocator& other) noexcept
+    {
+        pool = other.pool;
+        return *this;
+    }
+
+    template<class U>
+    interval_tree_pool_allocator(const interval_tree_pool_allocator<U>& other) noexcept : pool(other.pool) {}
+
+    T* allocate(std::size_t n)
+    {
+        if(n == 1 && pool->accepts(sizeof(T), alignof(T)))
+            return static_cast<T*>(pool->allocate(sizeof(T), alignof(T)));
+
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        if(n == 1 && pool->accepts(sizeof(T), alignof(T)))
+            pool->deallocate(p);
+        else
+            std::allocator<T>().deallocate(p, n);
+    }
+
+    void reserve(std::size_t n)
+    {
+        pool->reserve(n, sizeof(T), alignof(T));
+    }
+
+    void shrink_to_fit()
+    {
+        pool->shrink_to_fit();
+    }
+
+    std::size_t capacity() const noexcept { return pool->capacity(); }
+
+    // A copied container must not share its nodes storage with the original
+    interval_tree_pool_allocator select_on_container_copy_construction() const
+    {
+        return interval_tree_pool_allocator();
+    }
+
+    template<class U>
+    bool operator==(const interval_tree_pool_allocator<U>& other) const noexcept { return pool == other.pool; }
+
+    template<class U>
+    bool operator!=(const interval_tree_pool_allocator<U>& other) const noexcept { return pool != other.pool; }
+
+private:
+    std::shared_ptr<interval_tree_node_pool> pool;
+};
+
+
+
+// Subtree size of an interval_tree node, only kept when the tree is
+// instantiated with OrderStatistics
+template<class Size, bool>
+struct interval_tree_node_size {};
+
+template<class Size>
+struct interval_tree_node_size<Size, true>
+{
+    Size size = 1;
+};
+
+
 
 template<
     typename Key,
     typename T,
     typename Compare = std::less<Key>,
+    typename Allocator = std::allocator<std::pair<std::pair<Key, Key>, T>>,
+    bool OrderStatistics = false,
     typename std::enable_if<std::is_default_constructible<Key>::value, int>::type = 0
 >
 class interval_tree
@@ -28,17 +368,19 @@ public:
     typedef const value_type*                      const_pointer;
     typedef value_type&                            reference;
     typedef const value_type&                      const_reference;
+    typedef Allocator                              allocator_type;
 
 
 
     // ====== NODE =============================================================
-    class node
+    class node : public interval_tree_node_size<size_type, OrderStatistics>
     {
         friend class interval_tree;
 
-        node() = default;
-        template<class... Args>
-        node(Args&& ...args) : data(std::forward<Args>(args)...) {}
+        // data is left uninitialized here, it is constructed and destroyed
+        // through the allocator (see create_node / destroy_node)
+        node() {}
+        ~node() {}
 
         inline const key_type&    key()   { return data.first;   }
         inline const bound_type&  lower() { return key().first;  }
@@ -52,53 +394,18 @@ public:
         int         height  = 1;
         int         bfactor = 0;
         bound_type  max = bound_type();
-        value_type  data;
-    };
-
-    // ====== KEY COMPARE ======================================================
-    class comparator
-    {
-        friend class interval_tree;
-        friend class const_iterator;
-
-    public:
-        inline bool operator()(const bound_type& lhs, const bound_type& rhs) const { return less(lhs, rhs); }
-        inline bool operator()(const key_type&   lhs, const key_type&   rhs) const { return less(lhs, rhs); }
-        inline bool operator()(const value_type& lhs, const value_type& rhs) const { return less(lhs, rhs); }
-
-        inline bool less(const bound_type& lhs, const bound_type& rhs) const { return comp(lhs, rhs); }
-        inline bool less(const key_type& lhs, const key_type& rhs) const
-        {
-            return less(lhs.first, rhs.first) || (eq(rhs.first, lhs.first) && less(lhs.second, rhs.second));
-        }
-        inline bool less(const value_type& lhs, const value_type& rhs) const { return less(lhs.first, rhs.first); }
+        bound_type  min_upper = bound_type();
 
-        inline bool greater(const bound_type& lhs, const bound_type& rhs) const { return less(rhs, lhs); }
-        inline bool greater(const key_type&   lhs, const key_type&   rhs) const { return less(rhs, lhs); }
-        inline bool greater(const value_type& lhs, const value_type& rhs) const { return less(rhs, lhs); }
-
-        inline bool less_eq(const bound_type& lhs, const bound_type& rhs) const { return !greater(lhs, rhs); }
-        inline bool less_eq(const key_type&   lhs, const key_type&   rhs) const { return !greater(lhs, rhs); }
-        inline bool less_eq(const value_type& lhs, const value_type& rhs) const { return !greater(lhs, rhs); }
-
-        inline bool greater_eq(const bound_type& lhs, const bound_type& rhs) const { return !less(lhs, rhs); }
-        inline bool greater_eq(const key_type&   lhs, const key_type&   rhs) const { return !less(lhs, rhs); }
-        inline bool greater_eq(const value_type& lhs, const value_type& rhs) const { return !less(lhs, rhs); }
-
-        inline bool eq(const bound_type& lhs, const bound_type& rhs) const { return !less(lhs, rhs) && !greater(lhs, rhs); }
-        inline bool eq(const key_type&   lhs, const key_type&   rhs) const { return !less(lhs, rhs) && !greater(lhs, rhs); }
-        inline bool eq(const value_type& lhs, const value_type& rhs) const { return !less(lhs, rhs) && !greater(lhs, rhs); }
-
-        inline bool neq(const bound_type& lhs, const bound_type& rhs) const { return !eq(lhs, rhs); }
-        inline bool neq(const key_type&   lhs, const key_type&   rhs) const { return !eq(lhs, rhs); }
-        inline bool neq(const value_type& lhs, const value_type& rhs) const { return !eq(lhs, rhs); }
+        union { value_type data; };
+    };
 
-    protected:
-        comparator() = default;
-        comparator(Compare c) : comp(c) {}
+private:
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<node> node_allocator;
+    typedef std::allocator_traits<node_allocator>                                 node_traits;
 
-        Compare comp;
-    };
+public:
+    // ====== KEY COMPARE ======================================================
+    typedef interval_comparator<Key, T, Compare> comparator;
 
     typedef comparator key_compare;
     typedef comparator value_compare;
@@ -256,115 +563,341 @@ public:
     typedef std::reverse_iterator<iterator>       reverse_iterator;
     typedef std::reverse_iterator<const_iterator> reverse_const_iterator;
 
-public:
-    // ====== CONSTRUCTORS =====================================================
-    interval_tree() = default;
-    explicit interval_tree(const Compare& comp) : comp(comp) {}
 
-    template<class InputIt>
-    interval_tree(InputIt first, InputIt last, const Compare& comp = Compare()) :
-        comp(comp)
-    {
-        insert(first, last);
-    }
 
-    interval_tree(const interval_tree<Key, T>& copy) { *this = copy; }
-    interval_tree(interval_tree<Key, T>&& move) { *this = std::move(move); }
-    interval_tree(std::initializer_list<value_type> ilist, const Compare& comp = Compare()) :
-        comp(comp)
+    // ====== NODE HANDLE ======================================================
+    // Owns a node extracted from the tree. Its interval can be changed before
+    // inserting it back, without reallocating the node or touching the value.
+    class node_type
     {
-        insert(ilist);
-    }
-
+        friend class interval_tree;
 
+    public:
+        typedef interval_tree::key_type       key_type;
+        typedef interval_tree::mapped_type    mapped_type;
+        typedef interval_tree::allocator_type allocator_type;
 
-    // ====== DESTRUCTOR =======================================================
-    ~interval_tree()
-    {
-        clear();
-    }
+        node_type() = default;
 
+        node_type(node_type&& move) noexcept :
+            n(move.n),
+            alloc(std::move(move.alloc))
+        {
+            move.n = nullptr;
+            move.alloc.reset();
+        }
 
-    // ====== ASSIGNMENTS ======================================================
-    interval_tree& operator=(const interval_tree& copy)
-    {
-        if(root)
-            delete_node(root);
+        node_type& operator=(node_type&& move) noexcept
+        {
+            reset();
 
-        root = copy.root ? clone(copy.root) : nullptr;
-        node_count = copy.node_count;
-        comp = copy.comp;
+            n     = move.n;
+            alloc = std::move(move.alloc);
 
-        return *this;
-    }
+            move.n = nullptr;
+            move.alloc.reset();
 
-    interval_tree& operator=(interval_tree&& move) noexcept(std::is_nothrow_move_assignable<Compare>::value)
-    {
-        if(root)
-            delete_node(root);
+            return *this;
+        }
 
-        root = std::move(move.root);
-        node_count = std::move(move.node_count);
-        comp = std::move(move.comp);
+        ~node_type()
+        {
+            reset();
+        }
 
-        // Don't actually destroy move's content (since it's currently still
-        // refering to the same stuff as *this), just make sure the call to the
-        // destructor on move won't delete the contents of *this
-        move.root = nullptr;
+        bool empty() const noexcept { return !n; }
+        explicit operator bool() const noexcept { return n; }
 
-        return *this;
-    }
+        allocator_type get_allocator() const { return allocator_type(*alloc); }
 
-    interval_tree& operator=(std::initializer_list<value_type> ilist)
-    {
-        clear();
-        insert(ilist);
+        key_type&    key()    const { return n->data.first;  }
+        mapped_type& mapped() const { return n->data.second; }
 
-        return *this;
-    }
+        void swap(node_type& other) noexcept
+        {
+            std::swap(n,     other.n);
+            std::swap(alloc, other.alloc);
+        }
 
+    private:
+        node_type(node* n, const node_allocator& alloc) : n(n), alloc(alloc) {}
 
+        void reset()
+        {
+            if(n)
+                interval_tree::destroy_node(*alloc, n);
 
-    // ====== ITERATORS ========================================================
-    inline iterator begin() noexcept
-    {
-        return iterator(this, root ? leftest(root) : nullptr);
-    }
+            n = nullptr;
+            alloc.reset();
+        }
 
-    inline const_iterator begin() const noexcept
-    {
-        return const_iterator(this, root ? leftest(root) : nullptr);
-    }
+        node*                         n = nullptr;
+        std::optional<node_allocator> alloc;
+    };
 
-    inline const_iterator cbegin() const noexcept
+public:
+    // ====== OVERLAP RANGE ====================================================
+    // Lazy view of the elements overlapping an interval, in key order. Each
+    // increment resumes the walk from the current node through the parent
+    // links, nothing is computed ahead and no memory is allocated.
+    template<class It>
+    class overlap_iterator
     {
-        return const_iterator(this, root ? leftest(root) : nullptr);
-    }
+        friend class interval_tree;
 
-    inline iterator end() noexcept
-    {
-        return iterator(this);
-    }
+    public:
+        typedef interval_tree::difference_type difference_type;
+        typedef interval_tree::value_type      value_type;
+        typedef typename It::pointer           pointer;
+        typedef typename It::reference         reference;
+        typedef std::forward_iterator_tag      iterator_category;
 
-    inline const_iterator end() const noexcept
-    {
-        return const_iterator(this);
-    }
+    protected:
+        overlap_iterator(const interval_tree* t, node* n, const key_type& interval) :
+            tree(t), n(n), interval(interval) {}
 
-    inline const_iterator cend() const noexcept
-    {
-        return const_iterator(this);
-    }
+    public:
+        overlap_iterator() = default;
 
-    inline reverse_iterator rbegin() noexcept
-    {
-        return reverse_iterator(end());
-    }
+        inline bool operator==(const overlap_iterator& other) const { return n == other.n; }
+        inline bool operator!=(const overlap_iterator& other) const { return !(*this == other); }
 
-    inline reverse_const_iterator rbegin() const noexcept
-    {
-        return reverse_const_iterator(end());
-    }
+        inline reference operator*()  const { return n->data;  }
+        inline pointer   operator->() const { return &n->data; }
+
+        inline overlap_iterator& operator++()
+        {
+            n = tree->next_overlap(n, interval);
+            return *this;
+        }
+
+        inline overlap_iterator operator++(int)
+        {
+            overlap_iterator it(*this);
+            ++*this;
+            return it;
+        }
+
+        // The same element as a regular iterator of the tree
+        inline It base() const { return It(tree, n); }
+
+    protected:
+        const interval_tree* tree = nullptr;
+        node*                n    = nullptr;
+        key_type             interval;
+    };
+
+    template<class It>
+    class overlap_range
+#if defined(__cpp_lib_ranges)
+        : public std::ranges::view_interface<overlap_range<It>>
+#endif
+    {
+        friend class interval_tree;
+
+    public:
+        typedef overlap_iterator<It> iterator;
+
+    protected:
+        overlap_range(const interval_tree* t, const key_type& interval) :
+            first(t, t->first_overlap(interval), interval),
+            last(t, nullptr, interval) {}
+
+    public:
+        overlap_range() = default;
+
+        inline iterator begin() const { return first; }
+        inline iterator end()   const { return last;  }
+
+        inline bool empty() const { return first == last; }
+
+    protected:
+        iterator first;
+        iterator last;
+    };
+
+    // ====== CONSTRUCTORS =====================================================
+    interval_tree() = default;
+    explicit interval_tree(const Compare& comp, const Allocator& alloc = Allocator()) :
+        comp(comp),
+        alloc(alloc)
+    {}
+
+    explicit interval_tree(const Allocator& alloc) : alloc(alloc) {}
+
+    template<class InputIt>
+    interval_tree(InputIt first, InputIt last, const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+        comp(comp),
+        alloc(alloc)
+    {
+        insert(first, last);
+    }
+
+    template<class InputIt>
+    interval_tree(InputIt first, InputIt last, const Allocator& alloc) :
+        interval_tree(first, last, Compare(), alloc)
+    {}
+
+    template<class InputIt>
+    interval_tree(sorted_input_t, InputIt first, InputIt last, const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+        comp(comp),
+        alloc(alloc)
+    {
+        insert(sorted_input, first, last);
+    }
+
+    template<class InputIt>
+    interval_tree(sorted_input_t, InputIt first, InputIt last, const Allocator& alloc) :
+        interval_tree(sorted_input, first, last, Compare(), alloc)
+    {}
+
+    interval_tree(const interval_tree& copy) :
+        comp(copy.comp),
+        alloc(node_traits::select_on_container_copy_construction(copy.alloc))
+    {
+        assign_copy(copy);
+    }
+
+    interval_tree(const interval_tree& copy, const Allocator& alloc) :
+        comp(copy.comp),
+        alloc(alloc)
+    {
+        assign_copy(copy);
+    }
+
+    interval_tree(interval_tree&& move) noexcept(std::is_nothrow_move_constructible<Compare>::value) :
+        comp(std::move(move.comp)),
+        alloc(std::move(move.alloc))
+    {
+        steal(move);
+    }
+
+    interval_tree(interval_tree&& move, const Allocator& alloc) :
+        comp(move.comp),
+        alloc(alloc)
+    {
+        if(this->alloc == move.alloc)
+            steal(move);
+        else
+            assign_move(move);
+    }
+
+    interval_tree(std::initializer_list<value_type> ilist, const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+        comp(comp),
+        alloc(alloc)
+    {
+        insert(ilist);
+    }
+
+    interval_tree(std::initializer_list<value_type> ilist, const Allocator& alloc) :
+        interval_tree(ilist, Compare(), alloc)
+    {}
+
+
+
+    // ====== DESTRUCTOR =======================================================
+    ~interval_tree()
+    {
+        clear();
+    }
+
+
+    // ====== ASSIGNMENTS ======================================================
+    interval_tree& operator=(const interval_tree& copy)
+    {
+        if(this == &copy)
+            return *this;
+
+        clear();
+
+        if constexpr(node_traits::propagate_on_container_copy_assignment::value)
+            alloc = copy.alloc;
+
+        comp = copy.comp;
+        assign_copy(copy);
+
+        return *this;
+    }
+
+    interval_tree& operator=(interval_tree&& move) noexcept((node_traits::propagate_on_container_move_assignment::value ||
+                                                            node_traits::is_always_equal::value) &&
+                                                           std::is_nothrow_move_assignable<Compare>::value)
+    {
+        if(this == &move)
+            return *this;
+
+        clear();
+
+        comp = std::move(move.comp);
+
+        if constexpr(node_traits::propagate_on_container_move_assignment::value)
+        {
+            alloc = std::move(move.alloc);
+            steal(move);
+        }
+        else if(alloc == move.alloc)
+            steal(move);
+        else
+            assign_move(move);
+
+        return *this;
+    }
+
+    interval_tree& operator=(std::initializer_list<value_type> ilist)
+    {
+        clear();
+        insert(ilist);
+
+        return *this;
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type(alloc);
+    }
+
+
+
+    // ====== ITERATORS ========================================================
+    inline iterator begin() noexcept
+    {
+        return iterator(this, root ? leftest(root) : nullptr);
+    }
+
+    inline const_iterator begin() const noexcept
+    {
+        return const_iterator(this, root ? leftest(root) : nullptr);
+    }
+
+    inline const_iterator cbegin() const noexcept
+    {
+        return const_iterator(this, root ? leftest(root) : nullptr);
+    }
+
+    inline iterator end() noexcept
+    {
+        return iterator(this);
+    }
+
+    inline const_iterator end() const noexcept
+    {
+        return const_iterator(this);
+    }
+
+    inline const_iterator cend() const noexcept
+    {
+        return const_iterator(this);
+    }
+
+    inline reverse_iterator rbegin() noexcept
+    {
+        return reverse_iterator(end());
+    }
+
+    inline reverse_const_iterator rbegin() const noexcept
+    {
+        return reverse_const_iterator(end());
+    }
 
     inline reverse_const_iterator crbegin() const noexcept
     {
@@ -404,6 +937,21 @@ public:
         return std::numeric_limits<difference_type>::max();
     }
 
+    void reserve(size_type n)
+    {
+        if constexpr(is_pooled<node_allocator>::value)
+        {
+            if(n > node_count)
+                alloc.reserve(n - node_count);
+        }
+    }
+
+    void shrink_to_fit()
+    {
+        if constexpr(is_pooled<node_allocator>::value)
+            alloc.shrink_to_fit();
+    }
+
 
 
     // ===== MODIFIERS =========================================================
@@ -440,7 +988,7 @@ public:
 
     iterator insert(const_iterator hint, value_type&& value)
     {
-        return emplace_hint(hint, std::forward(value));
+        return emplace_hint(hint, std::move(value));
     }
 
     template<class P, typename std::enable_if<std::is_convertible<value_type, P&&>::value, int>::type = 0>
@@ -449,9 +997,69 @@ public:
         return emplace_hint(hint, std::forward<P>(value));
     }
 
+    // Inserts the node owned by nh, nh is left empty. If the interval is
+    // invalid, std::range_error is thrown and nh keeps the node.
+    iterator insert(node_type&& nh)
+    {
+        node* n = adopt(nh);
+
+        if(!n)
+            return end();
+
+        if(root)
+            insert(n);
+        else
+        {
+            node_count ++;
+            root = n;
+        }
+
+        return iterator(this, n);
+    }
+
+    iterator insert(const_iterator hint, node_type&& nh)
+    {
+        node* n = adopt(nh);
+
+        if(!n)
+            return end();
+
+        if(root)
+            insert(hint, n);
+        else
+        {
+            node_count ++;
+            root = n;
+        }
+
+        return iterator(this, n);
+    }
+
     template<class InputIt>
     void insert(InputIt first, InputIt last)
     {
+        if(!root)
+        {
+            build(first, last, false);
+            return;
+        }
+
+        while(first != last)
+        {
+            emplace(*first);
+            ++first;
+        }
+    }
+
+    template<class InputIt>
+    void insert(sorted_input_t, InputIt first, InputIt last)
+    {
+        if(!root)
+        {
+            build(first, last, true);
+            return;
+        }
+
         while(first != last)
         {
             emplace(*first);
@@ -464,10 +1072,25 @@ public:
         insert(ilist.begin(), ilist.end());
     }
 
+    // Inserts a batch at once. Large batches (relative to the tree) are merged
+    // with the elements in place and the tree is rebuilt in linear time, small
+    // ones are sorted and inserted one by one.
+    template<class InputIt>
+    void insert_batch(InputIt first, InputIt last)
+    {
+        insert_batch(create_nodes(first, last, false));
+    }
+
+    template<class InputIt>
+    void insert_batch(sorted_input_t, InputIt first, InputIt last)
+    {
+        insert_batch(create_nodes(first, last, true));
+    }
+
     template<class... Args>
     iterator emplace(Args&& ...args)
     {
-        node* n = new node(std::forward<Args>(args)...);
+        node* n = create_node(std::forward<Args>(args)...);
 
         if(root)
             insert(n);
@@ -483,7 +1106,7 @@ public:
     template<class... Args>
     iterator emplace_hint(const_iterator hint, Args&& ...args)
     {
-        node* n = new node(std::forward<Args>(args)...);
+        node* n = create_node(std::forward<Args>(args)...);
 
         if(root)
             insert(hint, n);
@@ -512,37 +1135,75 @@ public:
             return iterator(this);
     }
 
-    iterator erase(const_iterator first, const_iterator last)
+    // Unlinks the element at pos and hands its node over, the element is
+    // neither copied nor moved and pointers to it remain valid.
+    node_type extract(const_iterator pos)
     {
-        node* n = first.n;
+        unlink(pos.n);
 
-        while(first != last)
+        return node_type(pos.n, alloc);
+    }
+
+    node_type extract(const key_type& key)
+    {
+        node* n = root ? lower_bound(root, key) : nullptr;
+
+        if(!n || comp.neq(n->key(), key))
+            return node_type();
+
+        return extract(const_iterator(this, n));
+    }
+
+    // Changes the interval of the element at pos. If it keeps its place in
+    // the order, only max is fixed on the way up, otherwise the node is
+    // relinked where it belongs. The element itself is never moved.
+    iterator update_bounds(const_iterator pos, const key_type& key)
+    {
+        node* n = pos.n;
+
+        if(comp(key.second, key.first))
+            throw std::range_error("Invalid interval");
+
+        node* p = prev(n);
+        node* r = next(n);
+
+        if((!p || comp.less_eq(p->key(), key)) && (!r || comp.less_eq(key, r->key())))
         {
-            n = remove(first.n);
-            ++first;
+            n->data.first = key;
+            update_path(n);
+        }
+        else
+        {
+            unlink(n);
+
+            n->data.first = key;
+            reset_links(n);
+
+            if(root)
+                insert(n);
+            else
+            {
+                node_count ++;
+                root = n;
+            }
         }
 
         return iterator(this, n);
     }
 
-    size_type erase(const key_type& key)
+    iterator erase(const_iterator first, const_iterator last)
     {
-        if(!root)
-            return 0;
+        erase_range(first.n, last.n);
 
-        node* n = _find<node*>(key);
+        return iterator(this, last.n);
+    }
 
-        if(!n)
+    size_type erase(const key_type& key)
+    {
+        if(!root)
             return 0;
 
-        size_type r = 0;
-
-        do {
-            n = remove(n);
-            ++r;
-        } while(n && comp.eq(n->key(), key));
-
-        return r;
+        return erase_range(lower_bound(root, key), upper_bound(root, key));
     }
 
     void swap(interval_tree& other) noexcept(std::is_nothrow_swappable<Compare>::value)
@@ -550,17 +1211,187 @@ public:
         std::swap(root,       other.root);
         std::swap(node_count, other.node_count);
         std::swap(comp,       other.comp);
-    }
-
+
+        if constexpr(node_traits::propagate_on_container_swap::value)
+        {
+            using std::swap;
+            swap(alloc, other.alloc);
+        }
+    }
+
+
+
+    // ====== SPLIT / JOIN =====================================================
+
+    // Moves every element of source into this tree, source is left empty.
+    // Elements with equivalent keys from source are placed after the ones of
+    // this tree. Nodes are relinked, not reallocated, unless the allocators
+    // differ.
+    void merge(interval_tree& source)
+    {
+        if(this == &source || !source.root)
+            return;
+
+        if(alloc != source.alloc)
+        {
+            for(node* n = leftest(source.root); n; n = next(n))
+                emplace(std::move(n->data));
+
+            source.clear();
+            return;
+        }
+
+        if(!root)
+        {
+            steal(source);
+            return;
+        }
+
+        // O(m log(n/m + 1)) for m <= n: logarithmic for a handful of elements,
+        // linear for trees of similar sizes
+        root        = unite(root, source.root);
+        node_count += source.node_count;
+
+        source.root       = nullptr;
+        source.node_count = 0;
+    }
+
+    void merge(interval_tree&& source)
+    {
+        merge(source);
+    }
+
+    // Moves the elements with a key less than key to the first tree, and the
+    // others to the second. This tree is left empty. Needs OrderStatistics,
+    // the sizes of both parts are read from the subtree sizes.
+    std::pair<interval_tree, interval_tree> split(const key_type& key)
+    {
+        static_assert(OrderStatistics, "split() needs an interval_tree with OrderStatistics");
+
+        auto      parts = split(root, key);
+        size_type n     = size_of(parts.first);
+
+        std::pair<interval_tree, interval_tree> r(make_empty(), make_empty());
+
+        r.first.root        = parts.first;
+        r.first.node_count  = n;
+        r.second.root       = parts.second;
+        r.second.node_count = node_count - n;
+
+        root       = nullptr;
+        node_count = 0;
+
+        return r;
+    }
+
+    // Concatenates two trees, no key in left may be greater than a key in
+    // right. The result uses left's comparator and allocator.
+    static interval_tree join(interval_tree&& left, interval_tree&& right)
+    {
+        left.check_order(left.root, right.root);
+
+        interval_tree r(std::move(left));
+
+        if(r.alloc == right.alloc)
+        {
+            r.root        = r.join(r.root, right.root);
+            r.node_count += right.node_count;
+
+            right.root       = nullptr;
+            right.node_count = 0;
+        }
+        else
+            r.assign_move(right);
+
+        return r;
+    }
+
+    static interval_tree join(interval_tree&& left, value_type pivot, interval_tree&& right)
+    {
+        if(left.comp(pivot.first.second, pivot.first.first))
+            throw std::range_error("Invalid interval");
+
+        if((left.root  && left.comp.less(pivot.first, left.rightest(left.root)->key())) ||
+           (right.root && left.comp.less(right.leftest(right.root)->key(), pivot.first)))
+            throw std::invalid_argument("interval_tree::join: trees are not ordered");
+
+        interval_tree r(std::move(left));
+        node*         k = r.create_node(std::move(pivot));
+
+        if(r.alloc == right.alloc)
+        {
+            r.root        = r.join(r.root, k, right.root);
+            r.node_count += right.node_count + 1;
+
+            right.root       = nullptr;
+            right.node_count = 0;
+        }
+        else
+        {
+            r.root = r.join(r.root, k, nullptr);
+            r.node_count++;
+            r.assign_move(right);
+        }
+
+        return r;
+    }
+
 
 
     // ====== LOOKUP ===========================================================
 
     size_type count(const key_type& key) const
     {
-        return std::distance(lower_bound(key), upper_bound(key));
+        if constexpr(OrderStatistics)
+            return distance(lower_bound(key), upper_bound(key));
+        else
+            return std::distance(lower_bound(key), upper_bound(key));
+    }
+
+    // Position of the element at it in the container, size() for end().
+    // Needs OrderStatistics, as nth() below.
+    size_type rank(const_iterator it) const
+    {
+        static_assert(OrderStatistics, "rank() needs an interval_tree with OrderStatistics");
+
+        node* n = it.n;
+
+        if(!n)
+            return node_count;
+
+        size_type r = size_of(n->left);
+
+        for(; n->parent; n = n->parent)
+        {
+            if(!is_left_child(n))
+                r += size_of(n->parent->left) + 1;
+        }
+
+        return r;
+    }
+
+    // O(log n) with OrderStatistics, linear in the distance otherwise
+    difference_type distance(const_iterator first, const_iterator last) const
+    {
+        if constexpr(OrderStatistics)
+            return difference_type(rank(last)) - difference_type(rank(first));
+        else
+            return std::distance(first, last);
+    }
+
+    // The element at position i, end() if i >= size()
+    iterator nth(size_type i)
+    {
+        return iterator(this, nth_node(i));
+    }
+
+    const_iterator nth(size_type i) const
+    {
+        return const_iterator(this, nth_node(i));
     }
 
+    // Calls callback for each element overlapping point (or interval below),
+    // in key order. A callback returning bool stops the search on false.
     template<class CB>
     void at(const Key& point, CB callback)       { in(point, point, callback); }
 
@@ -581,6 +1412,22 @@ public:
         return r;
     }
 
+    // Stabs the tree with every point of [first, last) in a single walk.
+    // callback receives the position of the point in the range and an
+    // iterator to an element containing it, for each such pair. Elements
+    // come in key order. A callback returning bool stops the search on false.
+    template<class InputIt, class CB>
+    void at_batch(InputIt first, InputIt last, CB callback)
+    {
+        stab_batch(first, last, [&](size_type i, node* n){ return callback(i, iterator(this, n)); });
+    }
+
+    template<class InputIt, class CB>
+    void at_batch(InputIt first, InputIt last, CB callback) const
+    {
+        stab_batch(first, last, [&](size_type i, node* n){ return callback(i, const_iterator(this, n)); });
+    }
+
     template<class CB>
     void in(const Key& start, const Key& end, CB callback) { in({start, end}, callback); }
 
@@ -594,7 +1441,7 @@ public:
             throw std::range_error("Invalid interval");
 
         if(root)
-            search(root, interval, [&](node* n){ callback(iterator(this, n)); });
+            search(root, interval, [&](node* n){ return callback(iterator(this, n)); });
     }
 
     template<class CB>
@@ -604,7 +1451,7 @@ public:
             throw std::range_error("Invalid interval");
 
         if(root)
-            search(root, interval, [&](node* n){ callback(const_iterator(this, n)); });
+            search(root, interval, [&](node* n){ return callback(const_iterator(this, n)); });
     }
 
     std::vector<iterator> in(const Key& start, const Key& end)
@@ -635,6 +1482,239 @@ public:
         return r;
     }
 
+    // Calls callback for each element whose interval contains interval, in
+    // key order. A callback returning bool stops the search on false.
+    template<class CB>
+    void enclosing(const Key& start, const Key& end, CB callback)       { enclosing({start, end}, callback); }
+
+    template<class CB>
+    void enclosing(const Key& start, const Key& end, CB callback) const { enclosing({start, end}, callback); }
+
+    template<class CB>
+    void enclosing(const key_type& interval, CB callback)
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        if(root)
+            search_enclosing(root, interval, [&](node* n){ return callback(iterator(this, n)); });
+    }
+
+    template<class CB>
+    void enclosing(const key_type& interval, CB callback) const
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        if(root)
+            search_enclosing(root, interval, [&](node* n){ return callback(const_iterator(this, n)); });
+    }
+
+    std::vector<iterator> enclosing(const Key& start, const Key& end)
+    {
+        return enclosing({start, end});
+    }
+
+    std::vector<const_iterator> enclosing(const Key& start, const Key& end) const
+    {
+        return enclosing({start, end});
+    }
+
+    std::vector<iterator> enclosing(const key_type& interval)
+    {
+        std::vector<iterator> r;
+        enclosing(interval, [&](iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    std::vector<const_iterator> enclosing(const key_type& interval) const
+    {
+        std::vector<const_iterator> r;
+        enclosing(interval, [&](const_iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    // Calls callback for each element whose interval lies within interval, in
+    // key order. A callback returning bool stops the search on false.
+    template<class CB>
+    void enclosed_by(const Key& start, const Key& end, CB callback)       { enclosed_by({start, end}, callback); }
+
+    template<class CB>
+    void enclosed_by(const Key& start, const Key& end, CB callback) const { enclosed_by({start, end}, callback); }
+
+    template<class CB>
+    void enclosed_by(const key_type& interval, CB callback)
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        if(root)
+            search_enclosed(root, interval, [&](node* n){ return callback(iterator(this, n)); });
+    }
+
+    template<class CB>
+    void enclosed_by(const key_type& interval, CB callback) const
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        if(root)
+            search_enclosed(root, interval, [&](node* n){ return callback(const_iterator(this, n)); });
+    }
+
+    std::vector<iterator> enclosed_by(const Key& start, const Key& end)
+    {
+        return enclosed_by({start, end});
+    }
+
+    std::vector<const_iterator> enclosed_by(const Key& start, const Key& end) const
+    {
+        return enclosed_by({start, end});
+    }
+
+    std::vector<iterator> enclosed_by(const key_type& interval)
+    {
+        std::vector<iterator> r;
+        enclosed_by(interval, [&](iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    std::vector<const_iterator> enclosed_by(const key_type& interval) const
+    {
+        std::vector<const_iterator> r;
+        enclosed_by(interval, [&](const_iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    // The intervals closest to point without containing it: the one ending
+    // last before point and the first one starting after it, end() if none
+    std::pair<iterator, iterator> nearest(const Key& point)
+    {
+        return {iterator(this, last_ending_before(point)), iterator(this, first_starting_after(point))};
+    }
+
+    std::pair<const_iterator, const_iterator> nearest(const Key& point) const
+    {
+        return {const_iterator(this, last_ending_before(point)), const_iterator(this, first_starting_after(point))};
+    }
+
+    // The k intervals closest to point, closest first. The distance is the
+    // gap between point and the interval, 0 if it contains point. Key must
+    // support operator-, and its result operator<.
+    std::vector<iterator> nearest_k(const Key& point, size_type k)
+    {
+        std::vector<iterator> r;
+        for(node* n : nearest_nodes(point, k))
+            r.push_back(iterator(this, n));
+        return r;
+    }
+
+    std::vector<const_iterator> nearest_k(const Key& point, size_type k) const
+    {
+        std::vector<const_iterator> r;
+        for(node* n : nearest_nodes(point, k))
+            r.push_back(const_iterator(this, n));
+        return r;
+    }
+
+    // Whether any interval overlaps interval, in a single descent
+    bool any_overlap(const Key& start, const Key& end) const
+    {
+        return any_overlap({start, end});
+    }
+
+    bool any_overlap(const key_type& interval) const
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        return first_overlap(interval);
+    }
+
+    // The overlapping element with the lowest key, end() if none
+    iterator find_first_overlap(const Key& start, const Key& end)
+    {
+        return find_first_overlap({start, end});
+    }
+
+    const_iterator find_first_overlap(const Key& start, const Key& end) const
+    {
+        return find_first_overlap({start, end});
+    }
+
+    iterator find_first_overlap(const key_type& interval)
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        return iterator(this, first_overlap(interval));
+    }
+
+    const_iterator find_first_overlap(const key_type& interval) const
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        return const_iterator(this, first_overlap(interval));
+    }
+
+    overlap_range<iterator> overlapping_at(const Key& point)
+    {
+        return overlapping({point, point});
+    }
+
+    overlap_range<const_iterator> overlapping_at(const Key& point) const
+    {
+        return overlapping({point, point});
+    }
+
+    overlap_range<iterator> overlapping(const Key& start, const Key& end)
+    {
+        return overlapping({start, end});
+    }
+
+    overlap_range<const_iterator> overlapping(const Key& start, const Key& end) const
+    {
+        return overlapping({start, end});
+    }
+
+    overlap_range<iterator> overlapping(const key_type& interval)
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        return overlap_range<iterator>(this, interval);
+    }
+
+    overlap_range<const_iterator> overlapping(const key_type& interval) const
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        return overlap_range<const_iterator>(this, interval);
+    }
+
+    // Number of intervals containing point. Needs OrderStatistics, as
+    // count_in() below.
+    size_type count_at(const Key& point) const
+    {
+        return count_in({point, point});
+    }
+
+    // Number of intervals overlapping interval, without visiting them
+    size_type count_in(const Key& start, const Key& end) const
+    {
+        return count_in({start, end});
+    }
+
+    size_type count_in(const key_type& interval) const
+    {
+        if(comp(interval.second, interval.first))
+            throw std::range_error("Invalid interval");
+
+        return count_overlaps(root, interval, false);
+    }
+
     iterator find(const key_type& k)
     {
         return _find<iterator>(k);
@@ -650,66 +1730,311 @@ public:
         return _equal_range<iterator>(key);
     }
 
-    std::pair<const_iterator,const_iterator> equal_range(const key_type& key) const
-    {
-        return _equal_range<const_iterator>(key);
-    }
+    std::pair<const_iterator,const_iterator> equal_range(const key_type& key) const
+    {
+        return _equal_range<const_iterator>(key);
+    }
+
+    iterator lower_bound(const key_type& k)
+    {
+        return _lower_bound<iterator>(k);
+    }
+
+    const_iterator lower_bound(const key_type& k) const
+    {
+        return _lower_bound<const_iterator>(k);
+    }
+
+    iterator upper_bound(const key_type& k)
+    {
+        return _upper_bound<iterator>(k);
+    }
+
+    const_iterator upper_bound(const key_type& k) const
+    {
+        return _upper_bound<const_iterator>(k);
+    }
+
+
+
+    // ====== OBSERVER =========================================================
+    key_compare key_comp() const
+    {
+        return comp;
+    }
+
+    value_compare value_comp() const
+    {
+        return comp;
+    }
+
+
+
+    // ====== PRIVATE ==========================================================
+private:
+    // upper bound of an AVL tree height (1.44 log2(n)) for any size_type
+    static constexpr std::size_t max_depth = std::numeric_limits<size_type>::digits * 3 / 2;
+
+    node* find_root(node* n) const
+    {
+        if(!n)
+            return nullptr;
+
+        while(n->parent)
+            n = n->parent;
+
+        return n;
+    }
+
+    template<class... Args>
+    node* create_node(Args&& ...args)
+    {
+        auto  p = node_traits::allocate(alloc, 1);
+        node* n = ::new(static_cast<void*>(std::addressof(*p))) node;
+
+        try
+        {
+            node_traits::construct(alloc, std::addressof(n->data), std::forward<Args>(args)...);
+        }
+        catch(...)
+        {
+            n->~node();
+            node_traits::deallocate(alloc, p, 1);
+            throw;
+        }
+
+        n->max       = n->upper();
+        n->min_upper = n->upper();
+
+        return n;
+    }
+
+    void destroy_node(node* n)
+    {
+        destroy_node(alloc, n);
+    }
+
+    static void destroy_node(node_allocator& alloc, node* n)
+    {
+        node_traits::destroy(alloc, std::addressof(n->data));
+        n->~node();
+        node_traits::deallocate(alloc, std::pointer_traits<typename node_traits::pointer>::pointer_to(*n), 1);
+    }
+
+    void assign_copy(const interval_tree& copy)
+    {
+        root = copy.root ? clone(copy.root) : nullptr;
+        node_count = copy.node_count;
+    }
+
+    void assign_move(interval_tree& move)
+    {
+        // The allocators differ, nodes can't be adopted as-is, so every
+        // element is moved into a node allocated by this tree.
+        for(auto it = move.begin(); it != move.end(); ++it)
+            emplace_hint(end(), std::move(*it));
+
+        move.clear();
+    }
+
+    void steal(interval_tree& move) noexcept
+    {
+        // Don't actually destroy move's content (since it's currently still
+        // refering to the same stuff as *this), just make sure the call to the
+        // destructor on move won't delete the contents of *this
+        root       = move.root;
+        node_count = move.node_count;
+
+        move.root       = nullptr;
+        move.node_count = 0;
+    }
+
+    // Takes the node out of nh, ready to be linked
+    node* adopt(node_type& nh)
+    {
+        node* n = nh.n;
+
+        if(!n)
+            return nullptr;
+
+        if(comp(n->upper(), n->lower()))
+            throw std::range_error("Invalid interval");
+
+        nh.n = nullptr;
+        nh.alloc.reset();
+
+        reset_links(n);
+
+        return n;
+    }
+
+    // Makes n a lone leaf again
+    void reset_links(node* n)
+    {
+        n->parent    = nullptr;
+        n->left      = nullptr;
+        n->right     = nullptr;
+        n->height    = 1;
+        n->bfactor   = 0;
+        n->max       = n->upper();
+        n->min_upper = n->upper();
+
+        if constexpr(OrderStatistics)
+            n->size = 1;
+    }
+
+    // Destroys n if it holds an invalid interval
+    void check_interval(node* n)
+    {
+        if(comp(n->upper(), n->lower()))
+        {
+            destroy_node(n);
+            throw std::range_error("Invalid interval");
+        }
+    }
+
+    // Builds the whole tree from a range in O(n) (plus the sort if needed).
+    // A sorted forward range is read in place, anything else is first turned
+    // into nodes and stable sorted so duplicates keep their insertion order.
+    template<class InputIt>
+    void build(InputIt first, InputIt last, bool sorted)
+    {
+        typedef typename std::iterator_traits<InputIt>::iterator_category category;
+
+        if constexpr(std::is_base_of<std::forward_iterator_tag, category>::value)
+        {
+            if(sorted || std::is_sorted(first, last, [&](const auto& a, const auto& b){ return comp.less(a.first, b.first); }))
+            {
+                size_type count = static_cast<size_type>(std::distance(first, last));
+
+                auto make = [&]()
+                {
+                    node* n = create_node(*first);
+                    check_interval(n);
+                    ++first;
+                    return n;
+                };
+
+                root       = build(count, make);
+                node_count = count;
+                return;
+            }
+        }
+
+        assign_nodes(create_nodes(first, last, sorted));
+    }
+
+    // Turns a range into detached nodes sorted by key. Nothing is left behind
+    // if an element can't be created.
+    template<class InputIt>
+    std::vector<node*> create_nodes(InputIt first, InputIt last, bool sorted)
+    {
+        std::vector<node*> nodes;
+
+        try
+        {
+            for(; first != last; ++first)
+            {
+                nodes.push_back(nullptr);
+                nodes.back() = create_node(*first);
+
+                if(comp(nodes.back()->upper(), nodes.back()->lower()))
+                    throw std::range_error("Invalid interval");
+            }
+        }
+        catch(...)
+        {
+            destroy_nodes(nodes);
+            throw;
+        }
+
+        if(!sorted)
+            std::stable_sort(nodes.begin(), nodes.end(), [&](node* a, node* b){ return comp.less(a->key(), b->key()); });
 
-    iterator lower_bound(const key_type& k)
-    {
-        return _lower_bound<iterator>(k);
+        return nodes;
     }
 
-    const_iterator lower_bound(const key_type& k) const
+    void destroy_nodes(const std::vector<node*>& nodes)
     {
-        return _lower_bound<const_iterator>(k);
+        for(node* n : nodes)
+            if(n)
+                destroy_node(n);
     }
 
-    iterator upper_bound(const key_type& k)
+    // Relinks nodes sorted by key into a balanced tree, replacing the content
+    void assign_nodes(const std::vector<node*>& nodes)
     {
-        return _upper_bound<iterator>(k);
-    }
+        auto it   = nodes.begin();
+        auto make = [&]()
+        {
+            node* n   = *it++;
+            n->parent = nullptr;
+            n->left   = nullptr;
+            n->right  = nullptr;
+            return n;
+        };
 
-    const_iterator upper_bound(const key_type& k) const
-    {
-        return _upper_bound<const_iterator>(k);
+        root       = build(nodes.size(), make);
+        node_count = nodes.size();
     }
 
+    // Links the next count nodes given by make() into a perfectly balanced
+    // subtree. Nodes are requested in order, so the source is read once.
+    template<class Make>
+    node* build(size_type count, Make& make)
+    {
+        if(count == 0)
+            return nullptr;
 
+        size_type half = (count - 1) / 2;
+        node*     l    = build(half, make);
+        node*     n    = nullptr;
 
-    // ====== OBSERVER =========================================================
-    key_compare key_comp() const
-    {
-        return comp;
-    }
+        try
+        {
+            n = make();
+        }
+        catch(...)
+        {
+            if(l)
+                delete_node(l);
 
-    value_compare value_comp() const
-    {
-        return comp;
-    }
+            throw;
+        }
 
+        n->left = l;
+        if(l)
+            l->parent = n;
 
+        try
+        {
+            n->right = build(count - 1 - half, make);
+        }
+        catch(...)
+        {
+            delete_node(n);
+            throw;
+        }
 
-    // ====== PRIVATE ==========================================================
-private:
-    node* find_root(node* n) const
-    {
-        if(!n)
-            return nullptr;
+        if(n->right)
+            n->right->parent = n;
 
-        while(n->parent)
-            n = n->parent;
+        update_props(n);
 
         return n;
     }
 
-    node* clone(node* n, node* p = nullptr) const
+    node* clone(node* n, node* p = nullptr)
     {
-        node* nn    = new node(n->data);
-        nn->parent  = p;
-        nn->max     = n->max;
-        nn->height  = n->height;
-        nn->bfactor = n->bfactor;
+        node* nn    = create_node(n->data);
+        nn->parent    = p;
+        nn->max       = n->max;
+        nn->min_upper = n->min_upper;
+        nn->height    = n->height;
+        nn->bfactor   = n->bfactor;
+
+        if constexpr(OrderStatistics)
+            nn->size = n->size;
 
         if(n->left)
             nn->left = clone(n->left, nn);
@@ -720,38 +2045,83 @@ private:
         return nn;
     }
 
-    void update_props(node* n)
+    // Recomputes max, min_upper, height, balance factor and size of n from its
+    // children. Returns true if max, min_upper or height changed, the parent
+    // then needs an update.
+    bool update_props(node* n)
     {
-        bound_type m = n->upper();
-        int        h = 1;
-        int        b = 0;
+        bound_type m  = n->upper();
+        bound_type mu = n->upper();
+        int        h  = 1;
+        int        b  = 0;
 
         if(n->right)
         {
-            m = std::max(m, n->right->max, comp.comp);
-            h = n->right->height + 1;
-            b = n->right->height;
+            m  = std::max(m, n->right->max, comp);
+            mu = std::min(mu, n->right->min_upper, comp);
+            h  = n->right->height + 1;
+            b  = n->right->height;
         }
 
         if(n->left)
         {
-            m  = std::max(m, n->left->max, comp.comp);
+            m  = std::max(m, n->left->max, comp);
+            mu = std::min(mu, n->left->min_upper, comp);
             h  = std::max(h, n->left->height + 1);
             b -= n->left->height;
         }
 
-        n->max     = m;
-        n->height  = h;
-        n->bfactor = b;
+        bool changed = h != n->height || comp.neq(m, n->max) || comp.neq(mu, n->min_upper);
 
-        if(n->parent)
-            update_props(n->parent);
+        n->max       = m;
+        n->min_upper = mu;
+        n->height    = h;
+        n->bfactor   = b;
+
+        if constexpr(OrderStatistics)
+            n->size = size_of(n->left) + size_of(n->right) + 1;
+
+        return changed;
+    }
+
+    // Sizes aren't part of the early exit of update_path and fix_up, the
+    // callers that add or remove nodes adjust them up to the root themselves.
+    // Without OrderStatistics there is nothing to adjust.
+    static void add_size(node* n, size_type d)
+    {
+        if constexpr(OrderStatistics)
+        {
+            for(; n; n = n->parent)
+                n->size += d;
+        }
+    }
+
+    static void sub_size(node* n, size_type d)
+    {
+        if constexpr(OrderStatistics)
+        {
+            for(; n; n = n->parent)
+                n->size -= d;
+        }
+    }
+
+    static size_type size_of(node* n)
+    {
+        static_assert(OrderStatistics, "subtree sizes are only kept with OrderStatistics");
+        return n ? n->size : 0;
+    }
+
+    // Updates n and its ancestors up to the first one left unchanged
+    void update_path(node* n)
+    {
+        while(n && update_props(n))
+            n = n->parent;
     }
 
     void delete_node(node* n)
     {
         delete_child(n);
-        delete n;
+        destroy_node(n);
     }
 
     void delete_child(node* n)
@@ -834,6 +2204,7 @@ private:
         n->parent   = tmp;
 
         update_props(n);
+        update_props(tmp);
 
         return tmp;
     }
@@ -860,6 +2231,7 @@ private:
         n->parent   = tmp;
 
         update_props(n);
+        update_props(tmp);
 
         return tmp;
     }
@@ -898,7 +2270,7 @@ private:
         return r;
     }
 
-    node* find_leaf_low(const key_type& k) const
+    node* find_leaf_high(const key_type& k) const
     {
         node* n = root;
         node* r = n;
@@ -906,63 +2278,487 @@ private:
         while(n)
         {
             r = n;
-            if(comp(n->key(), k))
+            if(comp(k, n->key()))
+                n = n->left;
+            else
+                n = n->right;
+        }
+
+        return r;
+    }
+
+    node* find_leaf(const_iterator h, const key_type& k) const
+    {
+        // the hint is only usable if k fits in [prior, h), otherwise fall
+        // back to the regular upper bound insertion
+        if(h == end() || comp(k, h.n->key()))
+        {
+            const_iterator prior = h;
+            if(prior == begin() || !comp(k, (--prior).n->key()))
+            {
+                if(h.n && !h.n->left)
+                    return h.n;
+                else
+                    return prior.n;
+            }
+        }
+
+        return find_leaf_high(k);
+    }
+
+    // In-order walk of the nodes of n matching match(). go_left and go_right
+    // tell whether the subtrees of a node may hold a match. The path is kept
+    // on a fixed size stack, an AVL tree is never deeper than ~1.44 log2(n).
+    template<class Left, class Right, class Match, class CB>
+    void walk(node* n, const Left& go_left, const Right& go_right, const Match& match, const CB& cb) const
+    {
+        node* stack[max_depth];
+        int   top = 0;
+
+        while(n || top)
+        {
+            while(n)
+            {
+                stack[top++] = n;
+                n = n->left && go_left(n) ? n->left : nullptr;
+            }
+
+            n = stack[--top];
+
+            // if the current node matches, a callback returning false stops
+            if(match(n))
+            {
+                if constexpr(interval_callback_stops<decltype(cb(n))>)
+                {
+                    if(!cb(n))
+                        return;
+                }
+                else
+                    cb(n);
+            }
+
+            n = n->right && go_right(n) ? n->right : nullptr;
+        }
+    }
+
+    // The left subtree is worth visiting only if it reaches the interval, the
+    // right one only if it doesn't start after it
+    template<class CB>
+    void search(node* n, const key_type& interval, const CB& cb) const
+    {
+        walk(n,
+             [&](node* n){ return comp.greater_eq(n->left->max, interval.first); },
+             [&](node* n){ return comp.greater_eq(interval.second, n->lower()); },
+             [&](node* n){ return interval_overlaps(interval, n->key()); },
+             cb);
+    }
+
+    // Only the nodes starting before interval can enclose it, and a subtree
+    // is skipped when it doesn't reach the end of interval
+    template<class CB>
+    void search_enclosing(node* n, const key_type& interval, const CB& cb) const
+    {
+        walk(n,
+             [&](node* n){ return comp.greater_eq(n->left->max, interval.second); },
+             [&](node* n){ return comp.less_eq(n->lower(), interval.first) &&
+                                  comp.greater_eq(n->right->max, interval.second); },
+             [&](node* n){ return interval_encloses(n->key(), interval); },
+             cb);
+    }
+
+    // Only the nodes starting within interval can be enclosed by it, and a
+    // subtree is skipped when all of it ends after interval
+    template<class CB>
+    void search_enclosed(node* n, const key_type& interval, const CB& cb) const
+    {
+        walk(n,
+             [&](node* n){ return comp.greater_eq(n->lower(), interval.first) &&
+                                  comp.less_eq(n->left->min_upper, interval.second); },
+             [&](node* n){ return comp.less_eq(n->lower(), interval.second) &&
+                                  comp.less_eq(n->right->min_upper, interval.second); },
+             [&](node* n){ return interval_encloses(interval, n->key()); },
+             cb);
+    }
+
+    // Sorts the points if needed, keeping their position in the range, then
+    // stabs with all of them at once
+    template<class InputIt, class CB>
+    void stab_batch(InputIt first, InputIt last, const CB& cb) const
+    {
+        typedef typename std::iterator_traits<InputIt>::iterator_category category;
+
+        if(!root)
+            return;
+
+        if constexpr(std::is_base_of<std::random_access_iterator_tag, category>::value)
+        {
+            if(std::is_sorted(first, last, comp))
+            {
+                stab(size_type(last - first),
+                     [&](size_type i) -> const Key& { return first[i]; },
+                     [&](size_type i) { return i; },
+                     cb);
+
+                return;
+            }
+        }
+
+        std::vector<std::pair<Key, size_type>> points;
+
+        for(size_type i = 0; first != last; ++first, ++i)
+            points.emplace_back(*first, i);
+
+        std::stable_sort(points.begin(), points.end(), [&](const auto& a, const auto& b){ return comp.less(a.first, b.first); });
+
+        stab(points.size(),
+             [&](size_type i) -> const Key& { return points[i].first; },
+             [&](size_type i) { return points[i].second; },
+             cb);
+    }
+
+    // In-order walk carrying the slice of sorted points that may still match
+    // in each subtree. A subtree only keeps the points up to its max, the
+    // right one only those from the lower bound of its parent, so the descent
+    // is shared by all the points going the same way.
+    template<class Point, class Index, class CB>
+    void stab(size_type count, const Point& point, const Index& index, const CB& cb) const
+    {
+        struct frame { node* n; size_type lo, hi; };
+
+        // first position in [lo, hi) where pred fails
+        auto partition = [](size_type lo, size_type hi, auto pred)
+        {
+            while(lo < hi)
+            {
+                size_type mid = lo + (hi - lo) / 2;
+
+                if(pred(mid))
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+
+            return lo;
+        };
+
+        frame     stack[max_depth];
+        int       top = 0;
+        node*     n   = root;
+        size_type lo  = 0;
+        size_type hi  = count;
+
+        while(n || top)
+        {
+            while(n)
+            {
+                hi = partition(lo, hi, [&](size_type i){ return comp.less_eq(point(i), n->max); });
+
+                if(lo == hi)
+                {
+                    n = nullptr;
+                    break;
+                }
+
+                stack[top++] = {n, lo, hi};
+                n = n->left;
+            }
+
+            if(!top)
+                break;
+
+            frame f = stack[--top];
+            n = f.n;
+
+            size_type b = partition(f.lo, f.hi, [&](size_type i){ return comp.less(point(i), n->lower()); });
+
+            for(size_type i = b; i < f.hi && comp.less_eq(point(i), n->upper()); ++i)
+            {
+                if constexpr(interval_callback_stops<decltype(cb(index(i), n))>)
+                {
+                    if(!cb(index(i), n))
+                        return;
+                }
+                else
+                    cb(index(i), n);
+            }
+
+            n  = n->right;
+            lo = b;
+            hi = f.hi;
+        }
+    }
+
+    // Leftmost node of n that may reach start, the left subtrees ending
+    // before it are skipped
+    node* leftest_reaching(node* n, const Key& start) const
+    {
+        while(n->left && comp.greater_eq(n->left->max, start))
+            n = n->left;
+
+        return n;
+    }
+
+    // First node overlapping interval in key order, nullptr if none. A single
+    // descent: when the left subtree reaches the start of interval, either it
+    // holds the first match or the interval that reaches starts after the end
+    // and so do n and everything on its right.
+    node* first_overlap(const key_type& interval) const
+    {
+        node* n = root;
+
+        while(n)
+        {
+            if(n->left && comp.greater_eq(n->left->max, interval.first))
+                n = n->left;
+            else if(interval_overlaps(interval, n->key()))
+                return n;
+            else if(comp.greater(n->lower(), interval.second))
+                return nullptr;
+            else
                 n = n->right;
+        }
+
+        return nullptr;
+    }
+
+    // Next node after n overlapping interval, nullptr if none. The in-order
+    // walk goes on from n through the parent links, so it needs no stack,
+    // and it stops at the first node starting after the end of interval.
+    node* next_overlap(node* n, const key_type& interval) const
+    {
+        do
+        {
+            if(n->right &&
+               comp.greater_eq(interval.second, n->lower()) &&
+               comp.greater_eq(n->right->max, interval.first))
+            {
+                n = leftest_reaching(n->right, interval.first);
+            }
             else
+            {
+                while(n->parent && !is_left_child(n))
+                    n = n->parent;
+
+                n = n->parent;
+            }
+
+            if(n && comp.greater(n->lower(), interval.second))
+                return nullptr;
+        }
+        while(n && !interval_overlaps(interval, n->key()));
+
+        return n;
+    }
+
+    // The node ending before point with the greatest upper bound. Subtrees
+    // ending at or after point everywhere, or not beyond the best found yet,
+    // are skipped, and a subtree ending before point everywhere gives its max
+    // right away. Only the subtrees holding intervals that contain point are
+    // searched further.
+    node* last_ending_before(const Key& point) const
+    {
+        node* best = nullptr;
+        node* stack[max_depth + 1];
+        int   top  = 0;
+
+        if(root)
+            stack[top++] = root;
+
+        while(top)
+        {
+            node* n = stack[--top];
+
+            if(comp.greater_eq(n->min_upper, point))
+                continue;
+
+            if(best && comp.less_eq(n->max, best->upper()))
+                continue;
+
+            if(comp.less(n->max, point))
+            {
+                best = node_of_max(n);
+                continue;
+            }
+
+            if(comp.less(n->upper(), point) && (!best || comp.greater(n->upper(), best->upper())))
+                best = n;
+
+            if(n->left)
+                stack[top++] = n->left;
+
+            // the right subtree can't end before point if it doesn't start before
+            if(n->right && comp.less(n->lower(), point))
+                stack[top++] = n->right;
+        }
+
+        return best;
+    }
+
+    // The first node in key order starting after point
+    node* first_starting_after(const Key& point) const
+    {
+        node* r = nullptr;
+        node* n = root;
+
+        while(n)
+        {
+            if(comp.greater(n->lower(), point))
+            {
+                r = n;
                 n = n->left;
+            }
+            else
+                n = n->right;
         }
 
         return r;
     }
 
-    node* find_leaf_high(const key_type& k) const
+    // A node of n whose upper bound is the max of n
+    node* node_of_max(node* n) const
     {
-        node* n = root;
-        node* r = n;
+        for(;;)
+        {
+            if(n->right && comp.eq(n->right->max, n->max))
+                n = n->right;
+            else if(comp.eq(n->upper(), n->max))
+                return n;
+            else
+                n = n->left;
+        }
+    }
+
+    // Distance between a and b, the later key minus the earlier one in the
+    // order of Compare. Integral keys are subtracted in their unsigned type,
+    // the gap between far apart signed keys doesn't fit in the signed one.
+    auto gap(const Key& a, const Key& b) const
+    {
+        const Key& lo = comp.less(b, a) ? b : a;
+        const Key& hi = comp.less(b, a) ? a : b;
+
+        if constexpr(std::is_integral<Key>::value)
+        {
+            typedef typename std::make_unsigned<Key>::type unsigned_type;
+            return unsigned_type(unsigned_type(hi) - unsigned_type(lo));
+        }
+        else
+            return hi - lo;
+    }
+
+    // The k nodes closest to point, closest first. Best-first search: the
+    // subtrees are queued by the smallest distance they may hold, from their
+    // max when they end before point, or from a lower bound of the keys when
+    // they start after it. from is the node whose right subtree it is.
+    std::vector<node*> nearest_nodes(const Key& point, size_type k) const
+    {
+        typedef decltype(gap(point, point)) distance_type;
+
+        struct entry
+        {
+            distance_type d;
+            node*         n;
+            node*         from;
+            bool          whole;
+
+            bool operator<(const entry& o) const { return o.d < d; }
+        };
+
+        auto bound = [&](node* n, node* from) -> entry
+        {
+            if(comp.less(n->max, point))
+                return {gap(n->max, point), n, from, true};
+
+            if(from && comp.greater(from->lower(), point))
+                return {gap(point, from->lower()), n, from, true};
+
+            return {distance_type(), n, from, true};
+        };
+
+        std::vector<node*> r;
+        std::vector<entry> heap;
+
+        if(root && k)
+            heap.push_back(bound(root, nullptr));
+
+        while(!heap.empty() && r.size() < k)
+        {
+            std::pop_heap(heap.begin(), heap.end());
+            entry e = heap.back();
+            heap.pop_back();
+
+            if(!e.whole)
+            {
+                r.push_back(e.n);
+                continue;
+            }
+
+            node* n = e.n;
+
+            distance_type d = comp.less(n->upper(), point)    ? gap(n->upper(), point) :
+                              comp.greater(n->lower(), point) ? gap(point, n->lower()) :
+                                                                distance_type();
+
+            heap.push_back({d, n, nullptr, false});
+            std::push_heap(heap.begin(), heap.end());
 
-        while(n)
-        {
-            r = n;
-            if(comp(k, n->key()))
-                n = n->left;
-            else
-                n = n->right;
+            if(n->left)
+            {
+                heap.push_back(bound(n->left, e.from));
+                std::push_heap(heap.begin(), heap.end());
+            }
+
+            if(n->right)
+            {
+                heap.push_back(bound(n->right, n));
+                std::push_heap(heap.begin(), heap.end());
+            }
         }
 
         return r;
     }
 
-    node* find_leaf(const_iterator h, const key_type& k) const
+    // Counts the nodes of n overlapping interval. all_before tells that every
+    // lower bound in n is known not to be after the end of interval. Whole
+    // subtrees are then counted at once when they can't end before the start
+    // of interval, or when they start within interval.
+    size_type count_overlaps(node* n, const key_type& interval, bool all_before) const
     {
-        if(h == end() || !comp(h.n->key(), k))
+        static_assert(OrderStatistics, "count_at() and count_in() need an interval_tree with OrderStatistics");
+
+        size_type c = 0;
+
+        while(n && comp.greater_eq(n->max, interval.first))
         {
-            const_iterator prior = h;
-            if(prior == begin() || !comp(k, (--prior).n->key()))
+            if(all_before)
             {
-                if(!h.n->left)
-                    return h.n;
-                else
-                    return prior.n;
+                if(comp.greater_eq(n->min_upper, interval.first))
+                    return c + n->size;
+
+                if(comp.greater_eq(n->lower(), interval.first))
+                {
+                    // n and its right subtree start within interval
+                    c += size_of(n->right) + 1;
+                    n  = n->left;
+                    continue;
+                }
+            }
+            else if(comp.greater(n->lower(), interval.second))
+            {
+                // neither n nor its right subtree start in time
+                n = n->left;
+                continue;
             }
 
-            return find_leaf_high(k);
-        }
-
-        return find_leaf_low(k);
-    }
+            // the left subtree doesn't start after n
+            c += count_overlaps(n->left, interval, true);
 
-    template<class CB>
-    void search(node* n, const key_type& interval, CB cb) const
-    {
-        if(n->left && comp.greater_eq(n->left->max, interval.first))
-            search(n->left, interval, cb);
+            if(comp.greater_eq(n->upper(), interval.first))
+                c++;
 
-        // if the current node matches
-        if(interval_overlaps(interval, n->key()))
-            cb(n);
+            n = n->right;
+        }
 
-        if(n->right && comp.greater_eq(interval.second, n->lower()))
-            search(n->right, interval, cb);
+        return c;
     }
 
     template<class CB>
@@ -984,6 +2780,49 @@ private:
         insert(n, p);
     }
 
+    void insert_batch(const std::vector<node*>& batch)
+    {
+        if(batch.empty())
+            return;
+
+        if(!root)
+        {
+            assign_nodes(batch);
+            return;
+        }
+
+        // merging costs O(n + k), splitting and joining O(k log(n / k + 1))
+        if(batch.size() * size_type(root->height) < node_count)
+        {
+            root        = insert_sorted(root, batch.data(), batch.data() + batch.size());
+            node_count += batch.size();
+            return;
+        }
+
+        std::vector<node*> nodes;
+
+        try
+        {
+            nodes.reserve(node_count + batch.size());
+        }
+        catch(...)
+        {
+            destroy_nodes(batch);
+            throw;
+        }
+
+        for(node* n = leftest(root); n; n = next(n))
+            nodes.push_back(n);
+
+        nodes.insert(nodes.end(), batch.begin(), batch.end());
+
+        // stable: elements already in the tree stay in front of equal ones
+        std::inplace_merge(nodes.begin(), nodes.begin() + node_count, nodes.end(),
+                           [&](node* a, node* b){ return comp.less(a->key(), b->key()); });
+
+        assign_nodes(nodes);
+    }
+
     void insert(const_iterator hint, node* n)
     {
         node* p = find_leaf(hint, n->key());
@@ -993,8 +2832,7 @@ private:
 
     void insert(node* n, node* p)
     {
-        if(comp(n->upper(), n->lower()))
-            throw std::range_error("Invalid interval");
+        check_interval(n);
 
         n->parent = p;
 
@@ -1003,37 +2841,51 @@ private:
         else
             p->right = n;
 
-        update_props(n);
-
-        rebalance(p);
-
         node_count++;
+
+        add_size(p, 1);
+        fix_after_insert(p);
     }
 
     node* remove(node* n)
     {
-        node* r = next(n);
+        node* r = unlink(n);
+
+        destroy_node(n);
+
+        return r;
+    }
+
+    // Takes n out of the tree without destroying it, returns the next node
+    node* unlink(node* n)
+    {
+        node* r       = next(n);
+        bool  swapped = n->left && n->right;
 
-        if(n->left && n->right)
+        if(swapped)
             swap_nodes(n, r);
 
         node* v = n->left ? n->left : n->right;
+        node* p = n->parent;
 
         replace_in_parent(n, v);
 
         node_count--;
 
-        v = v ? v : n->parent;
-
-        if(v)
+        if(p)
         {
-            update_props(v);
-            rebalance(v);
-        }
-        else if(node_count == 0)
-            root = nullptr;
+            sub_size(p, 1);
+
+            if(node* t = fix_up(p))
+                root = t;
 
-        delete n;
+            // r took the place of n along with its max, which may still
+            // account for n
+            if(swapped)
+                update_path(r);
+        }
+        else
+            root = v;
 
         return r;
     }
@@ -1054,8 +2906,13 @@ private:
 
     void swap_nodes(node* a, node* b)
     {
-        std::swap(a->height , b->height);
-        std::swap(a->bfactor, b->bfactor);
+        std::swap(a->height   , b->height);
+        std::swap(a->bfactor  , b->bfactor);
+        std::swap(a->max      , b->max);
+        std::swap(a->min_upper, b->min_upper);
+
+        if constexpr(OrderStatistics)
+            std::swap(a->size, b->size);
 
         //================================
 
@@ -1106,39 +2963,385 @@ private:
 
         if(b->right)
             b->right->parent = b;
+
+        if(root == a)
+            root = b;
+        else if(root == b)
+            root = a;
     }
 
-    void rebalance(node* n)
+    // Restores the balance of n with a single or double rotation and
+    // returns the new root of that subtree
+    node* balance(node* n)
     {
         if(n->bfactor < -1)
         {
-            if(n->left && n->left->bfactor > 0)
-                n->left = rotate_left(n->left);
+            if(n->left->bfactor > 0)
+                rotate_left(n->left);
 
-            n = rotate_right(n);
+            return rotate_right(n);
         }
-        else if(n->bfactor > 1)
+        else
         {
-            if(n->right && n->right->bfactor < 0)
-                n->right = rotate_right(n->right);
+            if(n->right->bfactor < 0)
+                rotate_right(n->right);
 
-            n = rotate_left(n);
+            return rotate_left(n);
         }
+    }
 
-        if(n->parent)
-            rebalance(n->parent);
+    // Climbs from the parent of a new leaf. A rotation gives the subtree its
+    // former height back, so past that point only max may still change.
+    void fix_after_insert(node* n)
+    {
+        while(n)
+        {
+            bool changed = update_props(n);
+
+            if(n->bfactor < -1 || n->bfactor > 1)
+            {
+                n = balance(n);
+
+                if(!n->parent)
+                    root = n;
+
+                update_path(n->parent);
+                return;
+            }
+
+            if(!changed)
+                return;
+
+            n = n->parent;
+        }
+    }
+
+    // Climbs from n after its subtree changed in any way (erase, join). Several
+    // ancestors may need a rotation, it only stops once a subtree is left
+    // unchanged. Returns the top of the tree if it got there, null otherwise.
+    node* fix_up(node* n)
+    {
+        while(true)
+        {
+            bool changed = update_props(n);
+
+            if(n->bfactor < -1 || n->bfactor > 1)
+                n = balance(n);
+            else if(!changed)
+                return nullptr;
+
+            if(!n->parent)
+                return n;
+
+            n = n->parent;
+        }
+    }
+
+    static int height(node* n)
+    {
+        return n ? n->height : 0;
+    }
+
+    void link(node* k, node* l, node* r)
+    {
+        k->left  = l;
+        k->right = r;
+
+        if(l)
+            l->parent = k;
+
+        if(r)
+            r->parent = k;
+
+        update_props(k);
+    }
+
+    // Joins the detached subtrees l and r around k, everything in l is not
+    // greater than k and everything in r is not less than k. The taller tree
+    // is walked down to the height of the shorter one: O(|height difference|).
+    node* join(node* l, node* k, node* r)
+    {
+        int hl = height(l);
+        int hr = height(r);
+
+        k->parent = nullptr;
+
+        if(hl > hr + 1)
+        {
+            node* p = l;
+
+            while(height(p->right) > hr + 1)
+                p = p->right;
+
+            if constexpr(OrderStatistics)
+                add_size(p, size_of(r) + 1);
+
+            link(k, p->right, r);
+            k->parent = p;
+            p->right  = k;
+
+            node* t = fix_up(p);
+            return t ? t : l;
+        }
+        else if(hr > hl + 1)
+        {
+            node* p = r;
+
+            while(height(p->left) > hl + 1)
+                p = p->left;
+
+            if constexpr(OrderStatistics)
+                add_size(p, size_of(l) + 1);
+
+            link(k, l, p->left);
+            k->parent = p;
+            p->left   = k;
+
+            node* t = fix_up(p);
+            return t ? t : r;
+        }
+
+        link(k, l, r);
+
+        return k;
+    }
+
+    node* join(node* l, node* r)
+    {
+        if(!l)
+            return r;
+
+        if(!r)
+            return l;
+
+        // the last node of l becomes the pivot
+        node* k = rightest(l);
+        node* p = k->parent;
+
+        replace_in_parent(k, k->left);
+
+        if(p)
+        {
+            sub_size(p, 1);
+
+            node* t = fix_up(p);
+
+            if(t)
+                l = t;
+        }
         else
-            root = n;
+            l = k->left;
+
+        if(l)
+            l->parent = nullptr;
+
+        return join(l, k, r);
+    }
+
+    // Splits the detached subtree t into the keys less than k and the others,
+    // or with upper into the keys not greater than k and the others
+    std::pair<node*, node*> split(node* t, const key_type& k, bool upper = false)
+    {
+        if(!t)
+            return {nullptr, nullptr};
+
+        node* l = t->left;
+        node* r = t->right;
+
+        if(l)
+            l->parent = nullptr;
+
+        if(r)
+            r->parent = nullptr;
+
+        if(upper ? comp.less_eq(t->key(), k) : comp.less(t->key(), k))
+        {
+            auto parts = split(r, k, upper);
+            return {join(l, t, parts.first), parts.second};
+        }
+        else
+        {
+            auto parts = split(l, k, upper);
+            return {parts.first, join(parts.second, t, r)};
+        }
+    }
+
+    // Adds the sorted nodes [first, last) to the detached subtree t. t is split
+    // after the key of the middle node, which then joins the two halves with
+    // the two halves of the batch added: O(k log(n / k + 1)) for k nodes.
+    // Nodes land after the equal keys of t, as with insert().
+    node* insert_sorted(node* t, node* const* first, node* const* last)
+    {
+        if(first == last)
+            return t;
+
+        node* const* mid   = first + (last - first) / 2;
+        auto         parts = split(t, (*mid)->key(), true);
+
+        node* l = insert_sorted(parts.first, first, mid);
+        node* r = insert_sorted(parts.second, mid + 1, last);
+
+        return join(l, *mid, r);
+    }
+
+    // Splits the detached tree t into the nodes before x and the nodes from x
+    // on. Climbing from x, every ancestor is joined to the side x isn't on,
+    // which takes O(log n) altogether.
+    std::pair<node*, node*> split_at(node* t, node* x)
+    {
+        if(!x)
+            return {t, nullptr};
+
+        node* up[max_depth];
+        bool  from_left[max_depth];
+        int   top = 0;
+
+        // the links change along the way, save the path first
+        for(node* n = x; n->parent; n = n->parent, top++)
+        {
+            up[top]        = n->parent;
+            from_left[top] = is_left_child(n);
+        }
+
+        node* l = detach(x->left);
+        node* r = join(nullptr, x, detach(x->right));
+
+        for(int i = 0; i < top; i++)
+        {
+            node* a = up[i];
+
+            if(from_left[i])
+                r = join(r, a, detach(a->right));
+            else
+                l = join(detach(a->left), a, l);
+        }
+
+        return {l, r};
+    }
+
+    // Union of the detached trees a and b. The nodes of a are used as pivots
+    // to split b, so on equivalent keys the elements of a come first.
+    node* unite(node* a, node* b)
+    {
+        if(!a)
+            return b;
+
+        if(!b)
+            return a;
+
+        node* l     = detach(a->left);
+        node* r     = detach(a->right);
+        auto  parts = split(b, a->key());
+
+        l = unite(l, parts.first);
+        r = unite(r, parts.second);
+
+        return join(l, a, r);
+    }
+
+    static node* detach(node* n)
+    {
+        if(n)
+            n->parent = nullptr;
+
+        return n;
+    }
+
+    // Erases [first, last) with two splits and a join instead of one remove
+    // per element: O(log n + k)
+    size_type erase_range(node* first, node* last)
+    {
+        if(first == last)
+            return 0;
+
+        if(next(first) == last)
+        {
+            remove(first);
+            return 1;
+        }
+
+        auto head = split_at(root, first);
+        auto tail = split_at(head.second, last);
+
+        root = join(head.first, tail.second);
+
+        size_type k;
+
+        if constexpr(OrderStatistics)
+        {
+            k = tail.first->size;
+            delete_node(tail.first);
+        }
+        else
+            k = delete_tree(tail.first);
+
+        node_count -= k;
+
+        return k;
+    }
+
+    // Same as delete_node, returns the number of nodes destroyed
+    size_type delete_tree(node* n)
+    {
+        size_type k = 1;
+
+        if(n->left)
+            k += delete_tree(n->left);
+
+        if(n->right)
+            k += delete_tree(n->right);
+
+        destroy_node(n);
+
+        return k;
+    }
+
+    node* nth_node(size_type i) const
+    {
+        static_assert(OrderStatistics, "nth() needs an interval_tree with OrderStatistics");
+
+        node* n = i < node_count ? root : nullptr;
+
+        while(n)
+        {
+            size_type l = size_of(n->left);
+
+            if(i < l)
+                n = n->left;
+            else if(i == l)
+                break;
+            else
+            {
+                i -= l + 1;
+                n  = n->right;
+            }
+        }
+
+        return n;
+    }
+
+    // An empty tree with the same comparator and allocator as this one
+    interval_tree make_empty() const
+    {
+        interval_tree t(get_allocator());
+        t.comp = comp;
+        return t;
+    }
+
+    void check_order(node* l, node* r) const
+    {
+        if(l && r && comp.less(leftest(r)->key(), rightest(l)->key()))
+            throw std::invalid_argument("interval_tree::join: trees are not ordered");
     }
 
     bool interval_overlaps(const key_type& a, const key_type& b) const
     {
-        return comp.less_eq(a.first, b.second) && comp.greater_eq(a.second, b.first);
+        return comp.overlaps(a, b);
     }
 
     bool interval_encloses(const key_type& a, const key_type& b) const
     {
-        return comp.less_eq(a.first, b.first) && comp.greater_eq(a.second, b.second);
+        return comp.encloses(a, b);
     }
 
     template<class IT>
@@ -1147,9 +3350,9 @@ private:
         node* n = lower_bound(root, k);
 
         if(n && comp.eq(n->key(), k))
-            return n;
+            return IT(this, n);
 
-        return nullptr;
+        return IT(this);
     }
 
     template<class IT>
@@ -1175,31 +3378,83 @@ public:
     node* __get_root() {
         return root;
     }
+
+    // Checks links, ordering, balance and augmented data of the whole tree
+    bool __check_invariants() const {
+        size_type c = 0;
+        return (!root || (!root->parent && __check_node(root, c))) && c == node_count;
+    }
+
+private:
+    bool __check_node(node* n, size_type& c) const {
+        bound_type m  = n->upper();
+        bound_type mu = n->upper();
+        int        l  = 0;
+        int        r  = 0;
+        size_type  b  = c;
+
+        ++c;
+
+        if(n->left)
+        {
+            if(n->left->parent != n || comp.less(n->key(), n->left->key()) || !__check_node(n->left, c))
+                return false;
+
+            m  = std::max(m, n->left->max, comp);
+            mu = std::min(mu, n->left->min_upper, comp);
+            l  = n->left->height;
+        }
+
+        if(n->right)
+        {
+            if(n->right->parent != n || comp.less(n->right->key(), n->key()) || !__check_node(n->right, c))
+                return false;
+
+            m  = std::max(m, n->right->max, comp);
+            mu = std::min(mu, n->right->min_upper, comp);
+            r  = n->right->height;
+        }
+
+        if constexpr(OrderStatistics)
+        {
+            if(n->size != c - b)
+                return false;
+        }
+
+        return n->height == std::max(l, r) + 1 && n->bfactor == r - l && r - l <= 1 && l - r <= 1 && comp.eq(m, n->max) && comp.eq(mu, n->min_upper);
+    }
 #endif
 
 private:
-    node*      root = nullptr;
-    size_type  node_count = 0;
-    comparator comp;
+    template<class A, class = void>
+    struct is_pooled : std::false_type {};
+
+    template<class A>
+    struct is_pooled<A, decltype(std::declval<A&>().reserve(std::size_t()), std::declval<A&>().shrink_to_fit())> : std::true_type {};
+
+    node*          root = nullptr;
+    size_type      node_count = 0;
+    comparator     comp;
+    node_allocator alloc;
 };
 
-template<class K, class T, class C>
-void swap(interval_tree<K, T, C>& lhs,
-          interval_tree<K, T, C>& rhs) noexcept(noexcept(lhs.swap(rhs)))
+template<class K, class T, class C, class A, bool S>
+void swap(interval_tree<K, T, C, A, S>& lhs,
+          interval_tree<K, T, C, A, S>& rhs) noexcept(noexcept(lhs.swap(rhs)))
 {
     lhs.swap(rhs);
 }
 
-template<class K, class T, class C>
-void swap(typename interval_tree<K, T, C>::iterator& lhs,
-          typename interval_tree<K, T, C>::iterator& rhs) noexcept(noexcept(lhs.swap(rhs)))
+template<class K, class T, class C, class A, bool S>
+void swap(typename interval_tree<K, T, C, A, S>::iterator& lhs,
+          typename interval_tree<K, T, C, A, S>::iterator& rhs) noexcept(noexcept(lhs.swap(rhs)))
 {
     lhs.swap(rhs);
 }
 
-template<class K, class T, class C>
-bool operator==(const interval_tree<K, T, C>& lhs,
-                const interval_tree<K, T, C>& rhs)
+template<class K, class T, class C, class A, bool S>
+bool operator==(const interval_tree<K, T, C, A, S>& lhs,
+                const interval_tree<K, T, C, A, S>& rhs)
 {
     if(lhs.size() != rhs.size())
         return false;
@@ -1219,40 +3474,55 @@ bool operator==(const interval_tree<K, T, C>& lhs,
     return true;
 }
 
-template<class K, class T, class C>
-bool operator!=(const interval_tree<K, T, C>& lhs,
-                const interval_tree<K, T, C>& rhs)
+template<class K, class T, class C, class A, bool S>
+bool operator!=(const interval_tree<K, T, C, A, S>& lhs,
+                const interval_tree<K, T, C, A, S>& rhs)
 {
     return !(lhs == rhs);
 }
 
-template<class K, class T, class C>
-bool operator <(const interval_tree<K, T, C>& lhs,
-                const interval_tree<K, T, C>& rhs)
+template<class K, class T, class C, class A, bool S>
+bool operator <(const interval_tree<K, T, C, A, S>& lhs,
+                const interval_tree<K, T, C, A, S>& rhs)
 {
     return std::lexicographical_compare(lhs.cbegin(), lhs.cend(),
                                         rhs.cbegin(), rhs.cend());
 }
 
-template<class K, class T, class C>
-bool operator >(const interval_tree<K, T, C>& lhs,
-                const interval_tree<K, T, C>& rhs)
+template<class K, class T, class C, class A, bool S>
+bool operator >(const interval_tree<K, T, C, A, S>& lhs,
+                const interval_tree<K, T, C, A, S>& rhs)
 {
     return rhs < lhs;
 }
 
-template<class K, class T, class C>
-bool operator<=(const interval_tree<K, T, C>& lhs,
-                const interval_tree<K, T, C>& rhs)
+template<class K, class T, class C, class A, bool S>
+bool operator<=(const interval_tree<K, T, C, A, S>& lhs,
+                const interval_tree<K, T, C, A, S>& rhs)
 {
     return !(lhs > rhs);
 }
 
-template<class K, class T, class C>
-bool operator>=(const interval_tree<K, T, C>& lhs,
-                const interval_tree<K, T, C>& rhs)
+template<class K, class T, class C, class A, bool S>
+bool operator>=(const interval_tree<K, T, C, A, S>& lhs,
+                const interval_tree<K, T, C, A, S>& rhs)
 {
     return !(lhs < rhs);
 }
 
+// An interval_tree keeping subtree sizes, for nth() and rank()
+template<class Key, class T, class Compare = std::less<Key>>
+using ranked_interval_tree = interval_tree<Key, T, Compare,
+                                           std::allocator<std::pair<std::pair<Key, Key>, T>>, true>;
+
+template<class Key, class T, class Compare = std::less<Key>>
+using pooled_interval_tree = interval_tree<Key, T, Compare,
+                                           interval_tree_pool_allocator<std::pair<std::pair<Key, Key>, T>>>;
+
+#if defined(__cpp_lib_memory_resource)
+template<class Key, class T, class Compare = std::less<Key>>
+using pmr_interval_tree = interval_tree<Key, T, Compare,
+                                        std::pmr::polymorphic_allocator<std::pair<std::pair<Key, Key>, T>>>;
+#endif
+
 #endif // INTERVAL_TREE_H
@@ -0,0 +1,228 @@
+#ifndef INTERVAL_TREE_PARALLEL_H
+#define INTERVAL_TREE_PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include <interval_tree.h>
+
+// ====== WORKER POOL ==========================================================
+// Persistent worker threads running batches of jobs. run(count, job) calls
+// job(i) for each i in [0, count), from the workers and the calling thread,
+// and returns when every call is done. Indices are handed out one at a time
+// as the threads get free. The first exception stops the remaining jobs and
+// is rethrown by run(). Concurrent runs on the same pool are serialized.
+//
+// Any executor with the same run(count, job) member may be passed to the
+// parallel queries below instead.
+class interval_tree_worker_pool
+{
+public:
+    // Starts threads - 1 workers (0 for one per hardware thread), the thread
+    // calling run() is the last one. Fewer are started if they can't be.
+    explicit interval_tree_worker_pool(unsigned threads = 0)
+    {
+        if(!threads)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+
+        for(unsigned t = 1; t < threads; ++t)
+        {
+            try
+            {
+                workers.emplace_back([this]{ work(); });
+            }
+            catch(const std::system_error&)
+            {
+                break;
+            }
+        }
+    }
+
+    interval_tree_worker_pool(const interval_tree_worker_pool&) = delete;
+    interval_tree_worker_pool& operator=(const interval_tree_worker_pool&) = delete;
+
+    ~interval_tree_worker_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+
+        wake.notify_all();
+
+        for(auto& t : workers)
+            t.join();
+    }
+
+    // Number of threads running the jobs, the caller of run() included
+    unsigned size() const noexcept
+    {
+        return unsigned(workers.size()) + 1;
+    }
+
+    template<class Job>
+    void run(std::size_t count, const Job& job)
+    {
+        if(!count)
+            return;
+
+        std::lock_guard<std::mutex> serial(run_mutex);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            task  = &job;
+            call  = [](const void* j, std::size_t i){ (*static_cast<const Job*>(j))(i); };
+            total = count;
+            next  = 0;
+            busy  = workers.size();
+            error = nullptr;
+            generation++;
+        }
+
+        wake.notify_all();
+
+        drain();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]{ return busy == 0; });
+
+        task = nullptr;
+
+        if(error)
+            std::rethrow_exception(std::exchange(error, nullptr));
+    }
+
+private:
+    void work()
+    {
+        std::size_t seen = 0;
+
+        for(;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]{ return stop || generation != seen; });
+
+                if(stop)
+                    return;
+
+                seen = generation;
+            }
+
+            drain();
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if(--busy == 0)
+                done.notify_one();
+        }
+    }
+
+    // Runs jobs of the current batch until none is left
+    void drain()
+    {
+        try
+        {
+            for(std::size_t i; (i = next++) < total;)
+                call(task, i);
+        }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if(!error)
+                error = std::current_exception();
+
+            next = total;
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex               run_mutex;
+    std::mutex               mutex;
+    std::condition_variable  wake;
+    std::condition_variable  done;
+
+    const void*              task = nullptr;
+    void                   (*call)(const void*, std::size_t) = nullptr;
+    std::size_t              total = 0;
+    std::atomic<std::size_t> next{0};
+    std::size_t              busy = 0;
+    std::size_t              generation = 0;
+    std::exception_ptr       error;
+    bool                     stop = false;
+};
+
+
+
+// ====== PARALLEL QUERIES =====================================================
+// Batches of interval queries spread over an executor. They only use the const
+// in() of the container, any number of threads may search a container at
+// once as long as none of them modifies it. Works with every container of the
+// library.
+
+// Number of queries a job takes at once
+inline constexpr std::size_t interval_tree_parallel_block = 256;
+
+// Runs the interval queries of [first, last) on executor. callback is called
+// concurrently with the position of the query and a const_iterator to each
+// match, it must be thread safe. A callback result converting to false stops
+// the current query only. An exception thrown by a query or the callback
+// stops the other jobs and is rethrown.
+template<class Tree, class RandomIt, class CB, class Executor>
+void parallel_query(const Tree& tree, RandomIt first, RandomIt last, CB callback, Executor& executor)
+{
+    typedef typename Tree::size_type      size_type;
+    typedef typename Tree::const_iterator const_iterator;
+
+    const size_type count = size_type(last - first);
+    const size_type block = interval_tree_parallel_block;
+
+    executor.run((count + block - 1) / block, [&](std::size_t b)
+    {
+        for(size_type i = b * block; i < std::min(count, (b + 1) * block); ++i)
+            tree.in(first[i], [&](const_iterator it){ return callback(i, it); });
+    });
+}
+
+// Same as parallel_query, the matches are gathered in a buffer per job and
+// merged at the end: they come by query, in the order of the queries, then in
+// key order.
+template<class Tree, class RandomIt, class Executor>
+std::vector<std::pair<typename Tree::size_type, typename Tree::const_iterator>>
+parallel_in(const Tree& tree, RandomIt first, RandomIt last, Executor& executor)
+{
+    typedef typename Tree::size_type                  size_type;
+    typedef typename Tree::const_iterator             const_iterator;
+    typedef std::pair<size_type, const_iterator>      match;
+
+    const size_type count = size_type(last - first);
+    const size_type block = interval_tree_parallel_block;
+
+    std::vector<std::vector<match>> buffers((count + block - 1) / block);
+
+    executor.run(buffers.size(), [&](std::size_t b)
+    {
+        for(size_type i = b * block; i < std::min(count, (b + 1) * block); ++i)
+            tree.in(first[i], [&](const_iterator it){ buffers[b].emplace_back(i, it); });
+    });
+
+    size_type total = 0;
+    for(auto& buffer : buffers)
+        total += buffer.size();
+
+    std::vector<match> r;
+    r.reserve(total);
+
+    for(auto& buffer : buffers)
+        r.insert(r.end(), buffer.begin(), buffer.end());
+
+    return r;
+}
+
+#endif // INTERVAL_TREE_PARALLEL_H
@@ -0,0 +1,347 @@
+#ifndef SORTED_INTERVAL_ARRAY_H
+#define SORTED_INTERVAL_ARRAY_H
+
+#include <interval_tree.h>
+
+// Common part of the immutable trees that keep their elements in a single
+// array in key order: the iterator, the constructors filling the array, and
+// the lookups that only need the order. Derived provides the search as
+// in(key_type, CB), builds its own index over values and has the last word
+// on everything else.
+template<
+    typename Derived,
+    typename Key,
+    typename T,
+    typename Compare,
+    typename Allocator
+>
+class sorted_interval_array
+{
+public:
+    // ====== TYPEDEFS =========================================================
+    typedef Key                                    bound_type;
+    typedef std::pair<Key, Key>                    key_type;
+    typedef T                                      mapped_type;
+
+    typedef std::size_t                            size_type;
+    typedef std::ptrdiff_t                         difference_type;
+    typedef std::pair<key_type, mapped_type>       value_type;
+    typedef value_type*                            pointer;
+    typedef const value_type*                      const_pointer;
+    typedef value_type&                            reference;
+    typedef const value_type&                      const_reference;
+    typedef Allocator                              allocator_type;
+
+
+
+protected:
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<value_type> value_allocator;
+
+public:
+    // ====== KEY COMPARE ======================================================
+    typedef interval_comparator<Key, T, Compare> comparator;
+
+    typedef comparator key_compare;
+    typedef comparator value_compare;
+
+
+
+    // ====== ITERATOR =========================================================
+    // Elements can't be modified, iterator and const_iterator are the same
+    class const_iterator
+    {
+        friend class sorted_interval_array;
+        friend Derived;
+
+    public:
+        typedef sorted_interval_array::difference_type  difference_type;
+        typedef sorted_interval_array::value_type       value_type;
+        typedef sorted_interval_array::const_pointer    pointer;
+        typedef sorted_interval_array::const_pointer    const_pointer;
+        typedef sorted_interval_array::const_reference  reference;
+        typedef sorted_interval_array::const_reference  const_reference;
+        typedef std::bidirectional_iterator_tag         iterator_category;
+
+    protected:
+        const_iterator(const sorted_interval_array* t, size_type i) : tree(t), i(i) {}
+
+    public:
+        const_iterator() = default;
+
+        inline void swap(const_iterator& other) noexcept
+        {
+            std::swap(tree, other.tree);
+            std::swap(i, other.i);
+        }
+
+        inline bool operator==(const const_iterator& other) const { return i == other.i; }
+        inline bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+        inline reference operator*()  const { return tree->values[i];  }
+        inline pointer   operator->() const { return &tree->values[i]; }
+
+        // end() is the position after the last element, and wraps around to
+        // the first one like the end of the other trees
+        inline const_iterator& operator++()
+        {
+            i = i < tree->size() ? i + 1 : 0;
+            return *this;
+        }
+
+        inline const_iterator operator++(int)
+        {
+            const_iterator it(*this);
+            ++*this;
+            return it;
+        }
+
+        inline const_iterator& operator--()
+        {
+            i = i > 0 ? i - 1 : tree->size();
+            return *this;
+        }
+
+        inline const_iterator operator--(int)
+        {
+            const_iterator it(*this);
+            --*this;
+            return it;
+        }
+
+    protected:
+        const sorted_interval_array* tree = nullptr;
+        size_type                    i    = 0;
+    };
+
+    typedef const_iterator                        iterator;
+    typedef std::reverse_iterator<const_iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> reverse_const_iterator;
+
+
+
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type(values.get_allocator());
+    }
+
+
+
+    // ====== ITERATORS ========================================================
+    inline const_iterator begin() const noexcept
+    {
+        return const_iterator(this, 0);
+    }
+
+    inline const_iterator cbegin() const noexcept
+    {
+        return begin();
+    }
+
+    inline const_iterator end() const noexcept
+    {
+        return const_iterator(this, size());
+    }
+
+    inline const_iterator cend() const noexcept
+    {
+        return end();
+    }
+
+    inline reverse_const_iterator rbegin() const noexcept
+    {
+        return reverse_const_iterator(end());
+    }
+
+    inline reverse_const_iterator crbegin() const noexcept
+    {
+        return rbegin();
+    }
+
+    inline reverse_const_iterator rend() const noexcept
+    {
+        return reverse_const_iterator(begin());
+    }
+
+    inline reverse_const_iterator crend() const noexcept
+    {
+        return rend();
+    }
+
+
+
+    // ====== CAPACITY =========================================================
+    bool empty() const noexcept
+    {
+        return values.empty();
+    }
+
+    size_type size() const noexcept
+    {
+        return values.size();
+    }
+
+
+
+    // ====== LOOKUP ===========================================================
+    size_type count(const key_type& key) const
+    {
+        return std::distance(lower_bound(key), upper_bound(key));
+    }
+
+    // Calls callback for each element overlapping point (or interval below),
+    // in key order. A callback returning bool stops the search on false.
+    template<class CB>
+    void at(const Key& point, CB callback) const { derived().in({point, point}, callback); }
+
+    std::vector<const_iterator> at(const Key& point) const
+    {
+        std::vector<const_iterator> r;
+        at(point, [&](const_iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    template<class CB>
+    void in(const Key& start, const Key& end, CB callback) const { derived().in({start, end}, callback); }
+
+    std::vector<const_iterator> in(const Key& start, const Key& end) const
+    {
+        return in({start, end});
+    }
+
+    std::vector<const_iterator> in(key_type interval) const
+    {
+        std::vector<const_iterator> r;
+        derived().in(interval, [&](const_iterator it){ r.push_back(it); });
+        return r;
+    }
+
+    const_iterator find(const key_type& k) const
+    {
+        auto it = lower_bound(k);
+
+        if(it != end() && comp.eq(it->first, k))
+            return it;
+
+        return end();
+    }
+
+    std::pair<const_iterator,const_iterator> equal_range(const key_type& key) const
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    const_iterator lower_bound(const key_type& k) const
+    {
+        auto it = std::lower_bound(values.begin(), values.end(), k, [&](const value_type& v, const key_type& k){ return comp.less(v.first, k); });
+        return const_iterator(this, size_type(it - values.begin()));
+    }
+
+    const_iterator upper_bound(const key_type& k) const
+    {
+        auto it = std::upper_bound(values.begin(), values.end(), k, [&](const key_type& k, const value_type& v){ return comp.less(k, v.first); });
+        return const_iterator(this, size_type(it - values.begin()));
+    }
+
+
+
+    // ====== OBSERVER =========================================================
+    key_compare key_comp() const
+    {
+        return comp;
+    }
+
+    value_compare value_comp() const
+    {
+        return comp;
+    }
+
+
+
+    // ====== CONSTRUCTORS =====================================================
+    // Only fill values, in key order. Derived builds its index afterwards.
+protected:
+    sorted_interval_array() = default;
+
+    explicit sorted_interval_array(const Allocator& alloc) : values(alloc) {}
+
+    // Copies the elements of tree
+    template<class A, bool S>
+    sorted_interval_array(const interval_tree<Key, T, Compare, A, S>& tree, const Allocator& alloc) :
+        comp(tree.key_comp()),
+        values(tree.begin(), tree.end(), alloc)
+    {}
+
+    // Moves the elements out of tree, tree is left empty
+    template<class A, bool S>
+    sorted_interval_array(interval_tree<Key, T, Compare, A, S>&& tree, const Allocator& alloc) :
+        comp(tree.key_comp()),
+        values(alloc)
+    {
+        values.reserve(tree.size());
+
+        for(auto& v : tree)
+            values.push_back(std::move(v));
+
+        tree.clear();
+    }
+
+    template<class InputIt>
+    sorted_interval_array(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc) :
+        comp(comp),
+        values(first, last, alloc)
+    {
+        check_intervals();
+        std::stable_sort(values.begin(), values.end(), [&](const value_type& a, const value_type& b){ return this->comp.less(a.first, b.first); });
+    }
+
+    // The range is already in key order, it isn't sorted again
+    template<class InputIt>
+    sorted_interval_array(sorted_input_t, InputIt first, InputIt last, const Compare& comp, const Allocator& alloc) :
+        comp(comp),
+        values(first, last, alloc)
+    {
+        check_intervals();
+    }
+
+
+
+    // ====== PRIVATE ==========================================================
+    void swap_values(sorted_interval_array& other) noexcept(std::is_nothrow_swappable<Compare>::value)
+    {
+        std::swap(comp, other.comp);
+        values.swap(other.values);
+    }
+
+    const Derived& derived() const
+    {
+        return static_cast<const Derived&>(*this);
+    }
+
+    void check_intervals() const
+    {
+        for(auto& v : values)
+        {
+            if(comp(v.first.second, v.first.first))
+                throw std::range_error("Invalid interval");
+        }
+    }
+
+    comparator                                 comp;
+    std::vector<value_type, value_allocator>   values;
+};
+
+template<class D, class K, class T, class C, class A>
+bool operator==(const sorted_interval_array<D, K, T, C, A>& lhs,
+                const sorted_interval_array<D, K, T, C, A>& rhs)
+{
+    return lhs.size() == rhs.size() && std::equal(lhs.cbegin(), lhs.cend(), rhs.cbegin());
+}
+
+template<class D, class K, class T, class C, class A>
+bool operator!=(const sorted_interval_array<D, K, T, C, A>& lhs,
+                const sorted_interval_array<D, K, T, C, A>& rhs)
+{
+    return !(lhs == rhs);
+}
+
+#endif // SORTED_INTERVAL_ARRAY_H
@@ -4,10 +4,19 @@
 #include <random>
 #include <chrono>
 #include <algorithm>
+#include <list>
 
 #include <interval_tree.h>
+#include <compact_interval_tree.h>
+#include <frozen_interval_tree.h>
+#include <implicit_interval_tree.h>
+#include <btree_interval_tree.h>
+#include <interval_tree_parallel.h>
 
 typedef interval_tree<int, std::string> itree;
+typedef ranked_interval_tree<int, std::string> rtree;
+typedef frozen_interval_tree<int, std::string> ftree;
+typedef implicit_interval_tree<int, std::string> mtree;
 typedef itree::value_type               value_type;
 typedef itree::key_type                 key_type;
 typedef itree::iterator                 iterator;
@@ -22,13 +31,15 @@ key_type get_random_key(int max)
     return k;
 }
 
-void fill(itree& tree, int s, int max)
+template<class Tree>
+void fill(Tree& tree, int s, int max)
 {
     for(int i = 0; i < s; i++)
         tree.emplace(get_random_key(max), std::to_string(i));
 }
 
-void fill_less_random(itree& tree, std::size_t s, int max)
+template<class Tree>
+void fill_less_random(Tree& tree, std::size_t s, int max)
 {
     int i = 0;
 
@@ -469,6 +480,32 @@ TEST_CASE("Deletion", "[test]")
         REQUIRE(it->second == "value4");
     }
 
+    SECTION("Delete range")
+    {
+        auto it = tree.erase(++tree.begin(), --tree.end());
+
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(tree.size() == 2);
+        REQUIRE(it->first == key_type(6, 7));
+        REQUIRE(tree.begin()->first == key_type(0, 1));
+
+        it = tree.erase(tree.begin(), tree.end());
+
+        REQUIRE(tree.empty());
+        REQUIRE(it == tree.end());
+    }
+
+    SECTION("Delete key")
+    {
+        for(int i = 0; i < 100; i++)
+            tree.insert({{3, 4}, "dup"});
+
+        REQUIRE(tree.erase(key_type(3, 4)) == 101);
+        REQUIRE(tree.erase(key_type(3, 4)) == 0);
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(tree.size() == 6);
+    }
+
     SECTION("Clear")
     {
         tree.clear();
@@ -569,6 +606,739 @@ TEST_CASE("Ordering", "[test]")
     }
 }
 
+TEMPLATE_TEST_CASE("Invariants", "[test]", itree, rtree)
+{
+    TestType tree;
+    compact_interval_tree<int, std::string> compact;
+
+    for(int i = 0; i < 2000; i++)
+    {
+        auto k = get_random_key(1000);
+
+        if(tree.size() > 50 && std::rand() % 3 == 0)
+        {
+            auto it = tree.begin();
+            auto ct = compact.begin();
+            auto d  = std::rand() % tree.size();
+            std::advance(it, d);
+            std::advance(ct, d);
+            tree.erase(it);
+            compact.erase(ct);
+        }
+        else
+        {
+            tree.emplace(k, std::to_string(i));
+            compact.emplace(k, std::to_string(i));
+        }
+
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(compact.__check_invariants());
+    }
+
+    REQUIRE(std::equal(tree.begin(), tree.end(), compact.begin(), compact.end()));
+
+    for(int i = 0; i < 50; i++)
+    {
+        TestType copy(tree);
+        std::vector<value_type> expected(copy.begin(), copy.end());
+
+        auto a = std::rand() % (copy.size() + 1);
+        auto b = std::rand() % (copy.size() + 1);
+
+        if(b < a)
+            std::swap(a, b);
+
+        copy.erase(std::next(copy.begin(), a), std::next(copy.begin(), b));
+        expected.erase(expected.begin() + a, expected.begin() + b);
+
+        REQUIRE(copy.__check_invariants());
+        REQUIRE(std::equal(copy.begin(), copy.end(), expected.begin(), expected.end()));
+    }
+
+    tree.erase(std::next(tree.begin(), 10), std::prev(tree.end(), 10));
+    REQUIRE(tree.__check_invariants());
+    REQUIRE(tree.size() == 20);
+}
+
+TEST_CASE("Bulk build", "[test]")
+{
+    std::vector<value_type> values;
+
+    for(int i = 0; i < 1000; i++)
+        values.emplace_back(get_random_key(100), std::to_string(i));
+
+    itree reference;
+
+    for(auto& v : values)
+        reference.insert(v);
+
+    SECTION("Unsorted range")
+    {
+        itree tree(values.begin(), values.end());
+
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(tree == reference);
+
+        // duplicates keep their insertion order
+        REQUIRE(std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+    }
+
+    SECTION("Sorted range")
+    {
+        std::vector<value_type> sorted(reference.begin(), reference.end());
+
+        for(std::size_t n : {0, 1, 2, 3, 7, 8, 1000})
+        {
+            itree tree(sorted_input, sorted.begin(), sorted.begin() + n);
+
+            REQUIRE(tree.__check_invariants());
+            REQUIRE(tree.size() == n);
+            REQUIRE(std::equal(tree.begin(), tree.end(), sorted.begin(), sorted.begin() + n));
+        }
+    }
+
+    SECTION("Insert into an empty tree")
+    {
+        itree tree;
+        tree.insert(values.begin(), values.end());
+
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+
+        tree.insert(sorted_input, values.begin(), values.begin() + 10);
+
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(tree.size() == 1010);
+    }
+
+    SECTION("Invalid interval")
+    {
+        values.emplace_back(key_type(3, 2), "invalid");
+
+        itree tree;
+
+        REQUIRE_THROWS_AS(tree.insert(values.begin(), values.end()), std::range_error);
+        REQUIRE(tree.empty());
+        REQUIRE_THROWS_AS(itree(sorted_input, values.end() - 2, values.end()), std::range_error);
+    }
+}
+
+TEMPLATE_TEST_CASE("Batch insert", "[test]", itree, rtree)
+{
+    TestType tree;
+    fill(tree, 1000, 100);
+
+    TestType reference(tree);
+
+    for(std::size_t k : {0, 1, 10, 60, 5000})
+    {
+        std::vector<value_type> batch;
+
+        for(std::size_t i = 0; i < k; i++)
+            batch.emplace_back(get_random_key(100), "batch" + std::to_string(i));
+
+        tree.insert_batch(batch.begin(), batch.end());
+
+        for(auto& v : batch)
+            reference.insert(v);
+
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(tree.size() == reference.size());
+
+        // equal keys end up after the ones already there, in batch order
+        REQUIRE(std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+    }
+
+    SECTION("Invalid interval")
+    {
+        std::vector<value_type> batch{{{0, 1}, "ok"}, {{3, 2}, "invalid"}};
+
+        REQUIRE_THROWS_AS(tree.insert_batch(batch.begin(), batch.end()), std::range_error);
+        REQUIRE(tree == reference);
+    }
+}
+
+TEST_CASE("Split", "[test]")
+{
+    rtree tree;
+    fill(tree, 1000, 100);
+
+    std::vector<value_type> content(tree.begin(), tree.end());
+
+    for(auto k : {key_type(-1, 0), key_type(50, 50), key_type(200, 200)})
+    {
+        rtree copy(tree);
+        auto parts = copy.split(k);
+
+        REQUIRE(copy.empty());
+        REQUIRE(parts.first.__check_invariants());
+        REQUIRE(parts.second.__check_invariants());
+        REQUIRE(parts.first.size() + parts.second.size() == content.size());
+        REQUIRE(std::distance(parts.first.begin(), parts.first.end()) == std::ptrdiff_t(parts.first.size()));
+
+        auto middle = std::lower_bound(content.begin(), content.end(), value_type(k, ""), tree.value_comp());
+
+        REQUIRE(std::equal(parts.first.begin(), parts.first.end(), content.begin(), middle));
+        REQUIRE(std::equal(parts.second.begin(), parts.second.end(), middle, content.end()));
+
+        rtree joined = rtree::join(std::move(parts.first), std::move(parts.second));
+
+        REQUIRE(joined.__check_invariants());
+        REQUIRE(std::equal(joined.begin(), joined.end(), content.begin(), content.end()));
+    }
+}
+
+TEMPLATE_TEST_CASE("Join", "[test]", itree, rtree)
+{
+    TestType tree;
+    fill(tree, 1000, 100);
+
+    std::vector<value_type> content(tree.begin(), tree.end());
+
+    SECTION("Join uneven trees")
+    {
+        for(std::size_t n : {0, 1, 10, 500})
+        {
+            TestType left(content.begin(), content.begin() + n);
+            TestType right(content.begin() + n, content.end());
+
+            TestType joined = TestType::join(std::move(left), std::move(right));
+
+            REQUIRE(joined.__check_invariants());
+            REQUIRE(std::equal(joined.begin(), joined.end(), content.begin(), content.end()));
+
+            TestType left2(content.begin(), content.end() - n);
+            TestType right2(content.end() - n, content.end());
+
+            joined = TestType::join(std::move(left2), std::move(right2));
+
+            REQUIRE(joined.__check_invariants());
+            REQUIRE(std::equal(joined.begin(), joined.end(), content.begin(), content.end()));
+        }
+    }
+
+    SECTION("Join with a pivot")
+    {
+        auto middle = std::lower_bound(content.begin(), content.end(), value_type({50, 50}, ""), tree.value_comp());
+
+        TestType left(content.begin(), middle);
+        TestType right(middle, content.end());
+
+        TestType joined = TestType::join(std::move(left), {{50, 50}, "pivot"}, std::move(right));
+
+        REQUIRE(joined.__check_invariants());
+        REQUIRE(joined.size() == content.size() + 1);
+
+        auto it = joined.lower_bound({50, 50});
+        REQUIRE(it->second == "pivot");
+    }
+
+    SECTION("Order violation")
+    {
+        TestType left{{{10, 20}, "a"}};
+        TestType right{{{0, 1}, "b"}};
+
+        REQUIRE_THROWS_AS(TestType::join(std::move(left), std::move(right)), std::invalid_argument);
+        REQUIRE(left.size() == 1);
+        REQUIRE(right.size() == 1);
+        REQUIRE_THROWS_AS(TestType::join(TestType(), {{5, 6}, "c"}, std::move(right)), std::invalid_argument);
+    }
+}
+
+TEST_CASE("Merge", "[test]")
+{
+    for(int m : {0, 1, 10, 1000})
+    {
+        itree tree;
+        itree source;
+        fill(tree, 1000, 100);
+        fill(source, m, 100);
+
+        for(auto& v : source)
+            v.second = "source" + v.second;
+
+        itree reference(tree);
+
+        for(auto& v : source)
+            reference.insert(v);
+
+        auto first = source.begin();
+
+        tree.merge(std::move(source));
+
+        REQUIRE(source.empty());
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(tree.size() == reference.size());
+
+        // elements of the source come after equivalent ones already there
+        REQUIRE(std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+
+        // nodes are moved, not copied
+        if(m)
+            REQUIRE(std::find_if(tree.begin(), tree.end(), [&](const value_type& v){ return &v == &*first; }) != tree.end());
+    }
+
+    SECTION("Into a smaller tree")
+    {
+        itree tree{{{50, 60}, "a"}};
+        itree source;
+        fill(source, 1000, 100);
+
+        tree.merge(source);
+
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(tree.size() == 1001);
+        REQUIRE(source.empty());
+    }
+}
+
+TEST_CASE("Node handles", "[test]")
+{
+    itree tree;
+    fill(tree, 1000, 100);
+
+    itree::node_type empty;
+    REQUIRE(empty.empty());
+    REQUIRE(!empty);
+
+    SECTION("Extract and change the bounds")
+    {
+        auto  it   = std::next(tree.begin(), 500);
+        auto* data = &*it;
+        auto  nh   = tree.extract(it);
+
+        REQUIRE(nh);
+        REQUIRE(tree.size() == 999);
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(&nh.key() == &data->first);
+
+        nh.key() = {1000, 2000};
+        std::string* value = &nh.mapped();
+
+        it = tree.insert(std::move(nh));
+
+        REQUIRE(nh.empty());
+        REQUIRE(tree.size() == 1000);
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(&*it == data);
+        REQUIRE(&it->second == value);
+        REQUIRE(it == --tree.end());
+    }
+
+    SECTION("Extract by key")
+    {
+        auto key = tree.begin()->first;
+        auto n   = tree.count(key);
+
+        for(std::size_t i = 0; i < n; i++)
+            REQUIRE(tree.extract(key).key() == key);
+
+        REQUIRE(!tree.extract(key));
+        REQUIRE(tree.size() == 1000 - n);
+        REQUIRE(tree.__check_invariants());
+    }
+
+    SECTION("Invalid interval")
+    {
+        auto nh = tree.extract(tree.begin());
+        nh.key() = {3, 2};
+
+        REQUIRE_THROWS_AS(tree.insert(std::move(nh)), std::range_error);
+        REQUIRE(nh);
+        REQUIRE(tree.size() == 999);
+
+        nh.key() = {2, 3};
+        tree.insert(tree.begin(), std::move(nh));
+
+        REQUIRE(tree.size() == 1000);
+        REQUIRE(tree.__check_invariants());
+    }
+}
+
+TEST_CASE("Update bounds", "[test]")
+{
+    itree tree;
+    fill(tree, 1000, 100);
+
+    for(int i = 0; i < 1000; i++)
+    {
+        auto  it   = std::next(tree.begin(), std::rand() % tree.size());
+        auto* data = &*it;
+        auto  k    = it->first;
+
+        // growing or shrinking the upper bound usually keeps the order
+        if(i % 2)
+            k.second = k.first + std::rand() % 200;
+        else
+            k = get_random_key(100);
+
+        it = tree.update_bounds(it, k);
+
+        REQUIRE(&*it == data);
+        REQUIRE(it->first == k);
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(std::is_sorted(tree.begin(), tree.end(), tree.value_comp()));
+    }
+
+    REQUIRE(tree.size() == 1000);
+    REQUIRE_THROWS_AS(tree.update_bounds(tree.begin(), {3, 2}), std::range_error);
+}
+
+TEST_CASE("Order statistics", "[test]")
+{
+    rtree tree;
+    fill(tree, 1000, 50);
+
+    std::size_t i = 0;
+
+    for(auto it = tree.begin(); it != tree.end(); ++it, ++i)
+    {
+        REQUIRE(tree.nth(i) == it);
+        REQUIRE(tree.rank(it) == i);
+        REQUIRE(tree.count(it->first) == std::size_t(std::distance(tree.lower_bound(it->first), tree.upper_bound(it->first))));
+    }
+
+    REQUIRE(tree.nth(tree.size()) == tree.end());
+    REQUIRE(tree.rank(tree.end()) == tree.size());
+    REQUIRE(tree.distance(tree.begin(), tree.end()) == 1000);
+    REQUIRE(tree.distance(tree.nth(700), tree.nth(200)) == -500);
+    REQUIRE(tree.count({200, 300}) == 0);
+
+    const rtree& ctree = tree;
+    REQUIRE(ctree.nth(10) == std::next(ctree.begin(), 10));
+
+    itree plain(tree.begin(), tree.end());
+    REQUIRE(plain.distance(plain.begin(), plain.end()) == 1000);
+    REQUIRE(plain.count(tree.nth(500)->first) == tree.count(tree.nth(500)->first));
+}
+
+TEST_CASE("Count overlaps", "[test]")
+{
+    rtree tree;
+    fill(tree, 2000, 1000);
+    fill_less_random(tree, 3000, 1000);
+
+    for(int i = 0; i < 500; i++)
+    {
+        int  p = std::rand() % 1100 - 50;
+        auto k = get_random_key(1000);
+
+        REQUIRE(tree.count_at(p) == tree.at(p).size());
+        REQUIRE(tree.count_in(k) == tree.in(k).size());
+    }
+
+    REQUIRE(tree.count_in(-10, 2000) == tree.size());
+    REQUIRE(rtree().count_at(0) == 0);
+    REQUIRE_THROWS_AS(tree.count_in(3, 2), std::range_error);
+}
+
+TEST_CASE("Overlap range", "[test]")
+{
+    itree tree;
+    fill(tree, 2000, 1000);
+    fill_less_random(tree, 3000, 1000);
+
+    for(int i = 0; i < 200; i++)
+    {
+        auto k = get_random_key(1000);
+        auto v = tree.in(k);
+
+        std::vector<itree::iterator> r;
+        for(auto it = tree.overlapping(k).begin(); it != tree.overlapping(k).end(); ++it)
+            r.push_back(it.base());
+
+        REQUIRE(r == v);
+
+        int  p = std::rand() % 1100 - 50;
+        auto c = static_cast<const itree&>(tree).overlapping_at(p);
+
+        REQUIRE(std::size_t(std::distance(c.begin(), c.end())) == tree.at(p).size());
+        REQUIRE(c.empty() == tree.at(p).empty());
+    }
+
+    SECTION("Stop early")
+    {
+        auto k = tree.begin()->first;
+        auto n = 0;
+
+        for(auto& v : tree.overlapping(k))
+        {
+            REQUIRE(v.first.first <= k.second);
+            REQUIRE(v.first.second >= k.first);
+
+            if(++n == 3)
+                break;
+        }
+
+        REQUIRE(n == 3);
+
+        auto r  = tree.overlapping(k);
+        auto it = std::find_if(r.begin(), r.end(), [&](const itree::value_type& v){ return v.first.second > k.second; });
+        REQUIRE(it != r.end());
+        REQUIRE(it->first.second > k.second);
+    }
+
+    REQUIRE(itree().overlapping(0, 10).empty());
+    REQUIRE(tree.overlapping(-100, -90).empty());
+    REQUIRE_THROWS_AS(tree.overlapping(3, 2), std::range_error);
+
+#if defined(__cpp_lib_ranges)
+    auto view = tree.overlapping(100, 200) | std::views::take(5);
+    REQUIRE(std::ranges::distance(view) == 5);
+#endif
+}
+
+TEST_CASE("First overlap", "[test]")
+{
+    itree tree;
+    fill(tree, 2000, 1000);
+    fill_less_random(tree, 3000, 1000);
+
+    for(int i = 0; i < 500; i++)
+    {
+        int  p = std::rand() % 1100 - 50;
+        auto k = i % 2 ? get_random_key(1100) : itree::key_type(p, p);
+        auto v = tree.in(k);
+
+        REQUIRE(tree.any_overlap(k) == !v.empty());
+        REQUIRE(tree.find_first_overlap(k) == (v.empty() ? tree.end() : v.front()));
+
+        std::size_t n = 0;
+        tree.in(k, [&](itree::iterator){ return ++n < 3; });
+        REQUIRE(n == std::min<std::size_t>(v.size(), 3));
+
+        // any result convertible to bool stops the search
+        n = 0;
+        tree.in(k, [&](itree::iterator){ return 3 - int(++n); });
+        REQUIRE(n == std::min<std::size_t>(v.size(), 3));
+    }
+
+    REQUIRE_FALSE(tree.any_overlap(-100, -90));
+    REQUIRE_FALSE(itree().any_overlap(0, 10));
+    REQUIRE(static_cast<const itree&>(tree).find_first_overlap(-100, -90) == tree.cend());
+    REQUIRE_THROWS_AS(tree.any_overlap(3, 2), std::range_error);
+    REQUIRE_THROWS_AS(tree.find_first_overlap(3, 2), std::range_error);
+}
+
+TEST_CASE("Containment", "[test]")
+{
+    itree tree;
+    fill(tree, 2000, 1000);
+    fill_less_random(tree, 3000, 1000);
+
+    for(int i = 0; i < 500; i++)
+    {
+        auto k = get_random_key(1100);
+
+        std::vector<itree::iterator> enclosing;
+        std::vector<itree::iterator> enclosed;
+        for(auto it = tree.begin(); it != tree.end(); ++it)
+        {
+            if(it->first.first <= k.first && it->first.second >= k.second)
+                enclosing.push_back(it);
+
+            if(it->first.first >= k.first && it->first.second <= k.second)
+                enclosed.push_back(it);
+        }
+
+        REQUIRE(tree.enclosing(k) == enclosing);
+        REQUIRE(tree.enclosed_by(k) == enclosed);
+        REQUIRE(static_cast<const itree&>(tree).enclosed_by(k.first, k.second).size() == enclosed.size());
+    }
+
+    std::size_t n = 0;
+    tree.enclosing(500, 500, [&](itree::iterator){ return ++n < 3; });
+    REQUIRE(n == 3);
+
+    REQUIRE(tree.enclosing(-10, 2000).empty());
+    REQUIRE(tree.enclosed_by(-10, 2000).size() == tree.size());
+    REQUIRE(itree().enclosed_by(0, 10).empty());
+    REQUIRE_THROWS_AS(tree.enclosing(3, 2), std::range_error);
+    REQUIRE_THROWS_AS(tree.enclosed_by(3, 2), std::range_error);
+}
+
+TEST_CASE("Nearest", "[test]")
+{
+    itree tree;
+    fill(tree, 300, 10000);
+
+    auto dist = [](const itree::key_type& k, int p)
+    {
+        return k.second < p ? p - k.second : k.first > p ? k.first - p : 0;
+    };
+
+    for(int i = 0; i < 500; i++)
+    {
+        int p = std::rand() % 11000 - 500;
+
+        auto before = tree.end();
+        auto after  = tree.end();
+        std::vector<int> d;
+        for(auto it = tree.begin(); it != tree.end(); ++it)
+        {
+            if(it->first.second < p && (before == tree.end() || it->first.second > before->first.second))
+                before = it;
+
+            if(it->first.first > p && after == tree.end())
+                after = it;
+
+            d.push_back(dist(it->first, p));
+        }
+
+        auto n = tree.nearest(p);
+        REQUIRE((n.first == tree.end()) == (before == tree.end()));
+        if(before != tree.end())
+            REQUIRE(n.first->first.second == before->first.second);
+        REQUIRE(n.second == after);
+
+        std::sort(d.begin(), d.end());
+        d.resize(10);
+
+        std::vector<int> nd;
+        for(auto it : tree.nearest_k(p, 10))
+            nd.push_back(dist(it->first, p));
+
+        REQUIRE(nd == d);
+    }
+
+    REQUIRE(tree.nearest_k(0, 1000).size() == tree.size());
+    REQUIRE(tree.nearest_k(0, 0).empty());
+    REQUIRE(itree().nearest_k(0, 3).empty());
+    REQUIRE(static_cast<const itree&>(tree).nearest(-1000).first == tree.cend());
+    REQUIRE(tree.nearest(20000).second == tree.end());
+
+    // gaps wider than the range of int
+    const int lo = std::numeric_limits<int>::min();
+    const int hi = std::numeric_limits<int>::max();
+
+    itree wide{{{lo, lo}, "min"}, {{-10, 10}, "middle"}, {{hi, hi}, "max"}};
+
+    auto r = wide.nearest_k(hi - 5, 3);
+    REQUIRE(r.size() == 3);
+    REQUIRE(r[0]->second == "max");
+    REQUIRE(r[1]->second == "middle");
+    REQUIRE(r[2]->second == "min");
+
+    r = wide.nearest_k(lo, 2);
+    REQUIRE(r[0]->second == "min");
+    REQUIRE(r[1]->second == "middle");
+}
+
+TEST_CASE("Batch stabbing", "[test]")
+{
+    itree tree;
+    fill(tree, 2000, 1000);
+    fill_less_random(tree, 3000, 1000);
+
+    std::vector<int> points;
+    for(int i = 0; i < 300; i++)
+        points.push_back(std::rand() % 1100 - 50);
+
+    auto check = [&](const std::vector<int>& points)
+    {
+        std::vector<std::vector<itree::iterator>> r(points.size());
+        tree.at_batch(points.begin(), points.end(), [&](std::size_t i, itree::iterator it){ r[i].push_back(it); });
+
+        for(std::size_t i = 0; i < points.size(); i++)
+            REQUIRE(r[i] == tree.at(points[i]));
+    };
+
+    SECTION("Unsorted")
+    {
+        check(points);
+    }
+
+    SECTION("Sorted")
+    {
+        std::sort(points.begin(), points.end());
+        check(points);
+    }
+
+    SECTION("Input iterators")
+    {
+        std::list<int> l(points.begin(), points.end());
+        std::size_t    n = 0;
+        static_cast<const itree&>(tree).at_batch(l.begin(), l.end(), [&](std::size_t, itree::const_iterator){ n++; });
+
+        std::size_t expected = 0;
+        for(int p : points)
+            expected += tree.at(p).size();
+
+        REQUIRE(n == expected);
+    }
+
+    SECTION("Stop early")
+    {
+        std::size_t n = 0;
+        tree.at_batch(points.begin(), points.end(), [&](std::size_t, itree::iterator){ return ++n < 10; });
+        REQUIRE(n == 10);
+
+        n = 0;
+        tree.at_batch(points.begin(), points.end(), [&](std::size_t, itree::iterator){ return 10 - int(++n); });
+        REQUIRE(n == 10);
+    }
+
+    std::size_t n = 0;
+    itree().at_batch(points.begin(), points.end(), [&](std::size_t, itree::iterator){ n++; });
+    tree.at_batch(points.begin(), points.begin(), [&](std::size_t, itree::iterator){ n++; });
+    REQUIRE(n == 0);
+}
+
+TEST_CASE("Parallel queries", "[test]")
+{
+    itree tree;
+    fill(tree, 2000, 1000);
+    fill_less_random(tree, 3000, 1000);
+
+    std::vector<itree::key_type> queries;
+    for(int i = 0; i < 2000; i++)
+        queries.push_back(get_random_key(1100));
+
+    std::vector<std::pair<std::size_t, itree::const_iterator>> expected;
+    for(std::size_t i = 0; i < queries.size(); i++)
+    {
+        for(auto it : tree.in(queries[i]))
+            expected.emplace_back(i, it);
+    }
+
+    interval_tree_worker_pool pool;
+    interval_tree_worker_pool pool3(3);
+    interval_tree_worker_pool single(1);
+
+    REQUIRE(single.size() == 1);
+    REQUIRE(parallel_in(tree, queries.begin(), queries.end(), pool) == expected);
+    REQUIRE(parallel_in(tree, queries.begin(), queries.end(), pool3) == expected);
+    REQUIRE(parallel_in(tree, queries.begin(), queries.end(), single) == expected);
+    REQUIRE(parallel_in(tree, queries.begin(), queries.begin(), pool3).empty());
+
+    // the pool is reused across calls and container types
+    frozen_interval_tree<int, std::string> frozen(tree);
+    auto matches = parallel_in(frozen, queries.begin(), queries.end(), pool3);
+    REQUIRE(std::equal(matches.begin(), matches.end(), expected.begin(), expected.end(),
+                       [](auto& a, auto& b){ return a.first == b.first && *a.second == *b.second; }));
+
+    std::atomic<std::size_t> n{0};
+    parallel_query(tree, queries.begin(), queries.end(), [&](std::size_t, itree::const_iterator){ n++; }, pool3);
+    REQUIRE(n == expected.size());
+
+    // a callback returning false stops its query
+    std::size_t hit = 0;
+    for(std::size_t i = 0; i < queries.size(); i++)
+        hit += !tree.in(queries[i]).empty();
+
+    n = 0;
+    parallel_query(tree, queries.begin(), queries.end(), [&](std::size_t, itree::const_iterator){ n++; return false; }, pool3);
+    REQUIRE(n == hit);
+
+    queries[1500] = {3, 2};
+    REQUIRE_THROWS_AS(parallel_in(tree, queries.begin(), queries.end(), pool3), std::range_error);
+    REQUIRE_THROWS_AS(parallel_in(tree, queries.begin(), queries.end(), single), std::range_error);
+
+    queries[1500] = {2, 3};
+    REQUIRE(parallel_in(tree, queries.begin(), queries.begin() + 1500, pool3).size() ==
+            std::size_t(std::count_if(expected.begin(), expected.end(), [](auto& m){ return m.first < 1500; })));
+}
+
 TEST_CASE("Swap", "[test]")
 {
     itree tree{
@@ -635,6 +1405,24 @@ TEST_CASE("Find point", "[test]")
         ++bf;
         ++bn;
     }
+
+    // the callback is not copied along the way down
+    struct counter
+    {
+        counter(int* c) : copies(c) {}
+        counter(const counter& other) : copies(other.copies) { ++*copies; }
+        void operator()(iterator) const {}
+
+        int* copies;
+    };
+
+    int copies_empty = 0;
+    int copies_full  = 0;
+
+    itree().at(point, counter(&copies_empty));
+    tree.at(point, counter(&copies_full));
+
+    REQUIRE(copies_full == copies_empty);
 }
 
 TEST_CASE("Find interval", "[test]")
@@ -678,13 +1466,34 @@ TEST_CASE("Find interval", "[test]")
 
     while(bf != find.end() && bn != naive.end())
     {
-        auto it = *bf;
-        REQUIRE(low  <= it->first.second);
-        REQUIRE(high >= it->first.first);
-        REQUIRE(*it == *bn);
-        ++bf;
-        ++bn;
+        auto it = *bf;
+        REQUIRE(low  <= it->first.second);
+        REQUIRE(high >= it->first.first);
+        REQUIRE(*it == *bn);
+        ++bf;
+        ++bn;
+    }
+}
+
+TEST_CASE("Find key", "[test]")
+{
+    itree tree;
+    fill(tree, 1000, 100);
+
+    for(auto it = tree.begin(); it != tree.end(); ++it)
+    {
+        auto f = tree.find(it->first);
+
+        REQUIRE(f != tree.end());
+        REQUIRE(f->first == it->first);
+        REQUIRE(f == tree.lower_bound(it->first));
     }
+
+    REQUIRE(tree.find({-5, -4}) == tree.end());
+    REQUIRE(static_cast<const itree&>(tree).find({200, 300}) == tree.cend());
+
+    itree empty;
+    REQUIRE(empty.find({0, 1}) == empty.end());
 }
 
 TEST_CASE("Equality", "[test]")
@@ -875,6 +1684,640 @@ TEST_CASE("Iterators", "[test]")
     }
 }
 
+template<class T>
+struct counting_allocator
+{
+    typedef T value_type;
+
+    counting_allocator(int* c) : count(c) {}
+
+    template<class U>
+    counting_allocator(const counting_allocator<U>& other) : count(other.count) {}
+
+    T* allocate(std::size_t n)
+    {
+        *count += static_cast<int>(n);
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        *count -= static_cast<int>(n);
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template<class U>
+    bool operator==(const counting_allocator<U>& other) const { return count == other.count; }
+
+    template<class U>
+    bool operator!=(const counting_allocator<U>& other) const { return count != other.count; }
+
+    int* count;
+};
+
+TEST_CASE("Allocator", "[test]")
+{
+    typedef counting_allocator<value_type>                               alloc;
+    typedef interval_tree<int, std::string, std::less<int>, alloc>      ctree;
+
+    int count = 0;
+
+    SECTION("Nodes go through the allocator")
+    {
+        {
+            ctree tree{alloc(&count)};
+            tree.insert({{{0, 1}, "value0"}, {{1, 2}, "value1"}, {{2, 3}, "value2"}});
+            REQUIRE(count == 3);
+
+            tree.erase(tree.begin());
+            REQUIRE(count == 2);
+
+            ctree copy(tree);
+            REQUIRE(count == 4);
+            REQUIRE(copy == tree);
+
+            REQUIRE_THROWS_AS(copy.insert({{3, 2}, "invalid"}), std::range_error);
+            REQUIRE(count == 4);
+            REQUIRE(copy.size() == 2);
+        }
+
+        REQUIRE(count == 0);
+    }
+
+    SECTION("Move with different allocators")
+    {
+        int other_count = 0;
+
+        ctree tree{{{{0, 1}, "value0"}, {{1, 2}, "value1"}}, alloc(&count)};
+        ctree moved(std::move(tree), alloc(&other_count));
+
+        REQUIRE(tree.empty());
+        REQUIRE(moved.size() == 2);
+        REQUIRE(count == 0);
+        REQUIRE(other_count == 2);
+        REQUIRE(moved.begin()->second == "value0");
+    }
+
+    SECTION("Node handles")
+    {
+        ctree tree{{{{0, 1}, "value0"}, {{1, 2}, "value1"}}, alloc(&count)};
+
+        {
+            auto nh = tree.extract(tree.begin());
+            REQUIRE(count == 2);
+        }
+
+        REQUIRE(count == 1);
+
+        auto nh = tree.extract(tree.begin());
+        nh.key() = {5, 6};
+        tree.insert(std::move(nh));
+
+        REQUIRE(count == 1);
+        REQUIRE(tree.begin()->first == key_type(5, 6));
+    }
+
+    SECTION("Merge with different allocators")
+    {
+        int other_count = 0;
+
+        ctree tree{{{{0, 1}, "value0"}, {{2, 3}, "value2"}}, alloc(&count)};
+        ctree source{{{{1, 2}, "value1"}}, alloc(&other_count)};
+
+        tree.merge(source);
+
+        REQUIRE(source.empty());
+        REQUIRE(tree.size() == 3);
+        REQUIRE(count == 3);
+        REQUIRE(other_count == 0);
+        REQUIRE((++tree.begin())->second == "value1");
+    }
+
+#if defined(__cpp_lib_memory_resource)
+    SECTION("Polymorphic allocator")
+    {
+        std::pmr::monotonic_buffer_resource resource;
+        pmr_interval_tree<int, std::string> tree(&resource);
+
+        fill_less_random(tree, 1000, 10000);
+
+        REQUIRE(tree.size() == 1000);
+        REQUIRE(tree.get_allocator().resource() == &resource);
+        REQUIRE(std::is_sorted(tree.begin(), tree.end(), tree.value_comp()));
+    }
+#endif
+}
+
+
+TEST_CASE("Node pool", "[test]")
+{
+    typedef pooled_interval_tree<int, std::string> ptree;
+
+    ptree tree;
+
+    SECTION("Reserve")
+    {
+        tree.reserve(1000);
+        auto capacity = tree.get_allocator().capacity();
+
+        REQUIRE(capacity >= 1000);
+
+        fill(tree, 1000, 1000);
+
+        REQUIRE(tree.get_allocator().capacity() == capacity);
+        REQUIRE(std::is_sorted(tree.begin(), tree.end(), tree.value_comp()));
+    }
+
+    SECTION("Recycling")
+    {
+        fill(tree, 500, 1000);
+        auto capacity = tree.get_allocator().capacity();
+
+        for(int i = 0; i < 5000; i++)
+        {
+            tree.erase(tree.begin());
+            tree.emplace(get_random_key(1000), std::to_string(i));
+        }
+
+        REQUIRE(tree.size() == 500);
+        REQUIRE(tree.get_allocator().capacity() == capacity);
+        REQUIRE(std::is_sorted(tree.begin(), tree.end(), tree.value_comp()));
+    }
+
+    SECTION("Shrink to fit")
+    {
+        fill(tree, 500, 1000);
+        tree.erase(tree.begin(), tree.end());
+        tree.shrink_to_fit();
+
+        REQUIRE(tree.empty());
+        REQUIRE(tree.get_allocator().capacity() == 0);
+
+        fill(tree, 10, 1000);
+        REQUIRE(tree.size() == 10);
+    }
+
+    SECTION("Copy doesn't share the pool")
+    {
+        fill(tree, 100, 1000);
+        ptree copy(tree);
+
+        REQUIRE(copy == tree);
+        REQUIRE(copy.get_allocator() != tree.get_allocator());
+    }
+
+    SECTION("Moved from tree is reusable")
+    {
+        fill(tree, 100, 1000);
+        ptree moved(std::move(tree));
+
+        REQUIRE(moved.size() == 100);
+
+        tree.reserve(200);
+        fill(tree, 100, 1000);
+        REQUIRE(tree.size() == 100);
+        REQUIRE(tree.__check_invariants());
+
+        ptree assigned;
+        assigned = std::move(tree);
+        tree.emplace(get_random_key(1000), "again");
+        tree.shrink_to_fit();
+
+        REQUIRE(tree.size() == 1);
+        REQUIRE(assigned.size() == 100);
+        REQUIRE(moved.__check_invariants());
+    }
+}
+
+
+TEST_CASE("Compact tree", "[test]")
+{
+    typedef compact_interval_tree<int, std::string> ctree;
+
+    itree reference;
+    ctree tree;
+
+    for(int i = 0; i < 2000; i++)
+    {
+        auto k = get_random_key(1000);
+        reference.emplace(k, std::to_string(i));
+        tree.emplace(k, std::to_string(i));
+    }
+
+    REQUIRE(tree.size() == 2000);
+    REQUIRE(std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+
+    SECTION("Lookup")
+    {
+        for(int p = 0; p < 1000; p += 50)
+        {
+            std::vector<value_type> expected, actual;
+            reference.at(p, [&](iterator it){ expected.push_back(*it); });
+            tree.at(p, [&](ctree::iterator it){ actual.push_back(*it); });
+            REQUIRE(expected == actual);
+
+            expected.clear();
+            actual.clear();
+            reference.in(p, p + 25, [&](iterator it){ expected.push_back(*it); });
+            tree.in(p, p + 25, [&](ctree::iterator it){ actual.push_back(*it); });
+            REQUIRE(expected == actual);
+        }
+
+        auto k = reference.begin()->first;
+        REQUIRE(tree.find(k) != tree.end());
+        REQUIRE(tree.count(k) == reference.count(k));
+    }
+
+    SECTION("Erase and reuse slots")
+    {
+        auto capacity = tree.capacity();
+
+        for(int i = 0; i < 1000; i++)
+        {
+            auto it = tree.begin();
+            std::advance(it, std::rand() % tree.size());
+            tree.erase(it);
+        }
+
+        for(int i = 0; i < 1000; i++)
+            tree.emplace(get_random_key(1000), std::to_string(i));
+
+        REQUIRE(tree.size() == 2000);
+        REQUIRE(tree.capacity() == capacity);
+        REQUIRE(std::distance(tree.begin(), tree.end()) == 2000);
+        REQUIRE(std::is_sorted(tree.begin(), tree.end(), tree.value_comp()));
+    }
+
+    SECTION("Iterators survive growth")
+    {
+        ctree small;
+        auto it = small.emplace(key_type{5, 10}, "first");
+
+        for(int i = 0; i < 1000; i++)
+            small.emplace(get_random_key(1000), std::to_string(i));
+
+        REQUIRE(small.capacity() > 16);
+        REQUIRE(it->first == key_type(5, 10));
+        REQUIRE(it->second == "first");
+    }
+
+    SECTION("Shrink to fit")
+    {
+        tree.erase(tree.begin(), std::next(tree.begin(), 1500));
+        tree.shrink_to_fit();
+
+        REQUIRE(tree.size() == 500);
+        REQUIRE(tree.capacity() == 500);
+        REQUIRE(std::equal(tree.begin(), tree.end(), std::next(reference.begin(), 1500), reference.end()));
+    }
+
+    SECTION("Copy and move")
+    {
+        ctree copy(tree);
+        REQUIRE(copy == tree);
+
+        ctree moved(std::move(copy));
+        REQUIRE(moved == tree);
+        REQUIRE(copy.empty());
+    }
+
+    SECTION("Stop early")
+    {
+        std::size_t n = 0;
+        tree.in(0, 1000, [&](ctree::iterator){ return ++n < 5; });
+        REQUIRE(n == 5);
+
+        n = 0;
+        tree.in(0, 1000, [&](ctree::iterator){ return 5 - int(++n); });
+        REQUIRE(n == 5);
+
+        n = 0;
+        static_cast<const ctree&>(tree).at(500, [&](ctree::const_iterator){ n++; return false; });
+        REQUIRE(n == 1);
+    }
+}
+
+TEMPLATE_TEST_CASE("Immutable trees", "[test]", ftree, mtree)
+{
+    itree reference;
+    fill(reference, 2000, 1000);
+    fill_less_random(reference, 3000, 1000);
+
+    TestType tree(reference);
+
+    REQUIRE(tree.size() == reference.size());
+    REQUIRE(tree.__check_invariants());
+    REQUIRE(std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+    REQUIRE(std::equal(tree.rbegin(), tree.rend(), reference.rbegin(), reference.rend()));
+
+    SECTION("Lookup")
+    {
+        for(int i = 0; i < 300; i++)
+        {
+            int  p = std::rand() % 1100 - 50;
+            auto k = get_random_key(1100);
+
+            std::vector<value_type> expected, actual;
+            reference.at(p, [&](iterator it){ expected.push_back(*it); });
+            tree.at(p, [&](typename TestType::iterator it){ actual.push_back(*it); });
+            REQUIRE(expected == actual);
+
+            expected.clear();
+            actual.clear();
+            reference.in(k, [&](iterator it){ expected.push_back(*it); });
+            for(auto it : tree.in(k))
+                actual.push_back(*it);
+            REQUIRE(expected == actual);
+
+            REQUIRE(tree.count(k) == reference.count(k));
+        }
+
+        auto k = std::next(reference.begin(), 1234)->first;
+        REQUIRE(tree.find(k) != tree.end());
+        REQUIRE(tree.find(k)->first == k);
+        REQUIRE(tree.find({-5, -4}) == tree.end());
+        REQUIRE_THROWS_AS(tree.in(3, 2), std::range_error);
+
+        std::size_t n = 0;
+        tree.in(0, 1000, [&](typename TestType::iterator){ return ++n < 5; });
+        REQUIRE(n == 5);
+
+        n = 0;
+        tree.in(0, 1000, [&](typename TestType::iterator){ return 5 - int(++n); });
+        REQUIRE(n == 5);
+    }
+
+    SECTION("Sizes")
+    {
+        for(int size : {0, 1, 2, 3, 7, 8, 9, 15, 16, 17, 33, 100, 1000})
+        {
+            itree small;
+            fill(small, size, 100);
+            itree copy(small);
+
+            TestType m(std::move(small));
+            REQUIRE(small.empty());
+            REQUIRE(m.size() == std::size_t(size));
+            REQUIRE(m.__check_invariants());
+            REQUIRE(std::distance(m.begin(), m.end()) == size);
+            REQUIRE(std::distance(m.rbegin(), m.rend()) == size);
+
+            for(int p = -1; p <= 101; p++)
+            {
+                std::vector<value_type> expected, actual;
+                copy.at(p, [&](iterator it){ expected.push_back(*it); });
+                m.at(p, [&](typename TestType::iterator it){ actual.push_back(*it); });
+                REQUIRE(expected == actual);
+            }
+        }
+    }
+
+    SECTION("From a range")
+    {
+        std::vector<value_type> values(reference.begin(), reference.end());
+        std::reverse(values.begin(), values.end());
+
+        TestType unsorted(values.begin(), values.end());
+        REQUIRE(unsorted.__check_invariants());
+        REQUIRE(unsorted.size() == reference.size());
+
+        TestType sorted(sorted_input, reference.begin(), reference.end());
+        REQUIRE(sorted == tree);
+        REQUIRE_FALSE(sorted != tree);
+
+        REQUIRE_THROWS_AS(TestType({{{3, 2}, "bad"}}), std::range_error);
+    }
+
+    SECTION("Swap")
+    {
+        TestType other;
+        swap(tree, other);
+        REQUIRE(tree.empty());
+        REQUIRE(other.size() == reference.size());
+        REQUIRE(other.__check_invariants());
+    }
+}
+
+TEST_CASE("Frozen tree match masks", "[test]")
+{
+    itree reference;
+    fill(reference, 2000, 1000);
+
+    ftree tree(reference);
+
+    std::vector<ftree::iterator> blocks;
+    tree.at_blocks(500, [&](ftree::iterator first, std::uint32_t mask)
+    {
+        for(std::size_t j = 0; j < ftree::bucket_size; j++)
+        {
+            if(mask & (1u << j))
+                blocks.push_back(std::next(first, j));
+        }
+    });
+
+    REQUIRE(blocks == tree.at(500));
+}
+
+TEMPLATE_TEST_CASE("Frozen tree kernels", "[test]", std::int32_t, std::int64_t, long long, float, double)
+{
+    interval_tree<TestType, int> reference;
+
+    for(int i = 0; i < 3000; i++)
+    {
+        TestType a = TestType(std::rand() % 2000 - 1000);
+        TestType b = a + TestType(std::rand() % 50);
+        reference.emplace(std::make_pair(a, b), i);
+    }
+
+    frozen_interval_tree<TestType, int> tree(reference);
+
+    std::vector<std::pair<TestType, TestType>> queries;
+    for(int i = 0; i < 300; i++)
+    {
+        TestType p = TestType(std::rand() % 2200 - 1100);
+        queries.emplace_back(p, p + TestType(std::rand() % 20));
+    }
+
+    __interval_simd_override.reset();
+    const interval_simd_level host = interval_simd_detect();
+
+    // every kernel the host supports gives the results of the pointer tree
+    for(auto level : {interval_simd_level::scalar, interval_simd_level::sse, interval_simd_level::avx2})
+    {
+        if(level > host)
+            continue;
+
+        __interval_simd_override = level;
+        REQUIRE(interval_simd_detect() == level);
+
+        for(auto& q : queries)
+        {
+            std::vector<std::pair<std::pair<TestType, TestType>, int>> expected, actual;
+            reference.in(q, [&](auto it){ expected.push_back(*it); });
+            tree.in(q, [&](auto it){ actual.push_back(*it); });
+            REQUIRE(expected == actual);
+        }
+    }
+
+    __interval_simd_override.reset();
+}
+
+TEST_CASE("B-tree", "[test]")
+{
+    typedef btree_interval_tree<int, std::string> btree;
+
+    itree reference;
+    btree tree;
+
+    for(int i = 0; i < 5000; i++)
+    {
+        auto k = get_random_key(1000);
+        reference.emplace(k, std::to_string(i));
+        tree.emplace(k, std::to_string(i));
+    }
+
+    REQUIRE(tree.size() == 5000);
+    REQUIRE(tree.__check_invariants());
+    REQUIRE_THROWS_AS(tree.emplace(key_type{3, 2}, "bad"), std::range_error);
+    REQUIRE_THROWS_AS(tree.emplace_hint(tree.end(), key_type{3, 2}, "bad"), std::range_error);
+    REQUIRE(tree.size() == 5000);
+    REQUIRE(std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+    REQUIRE(std::equal(tree.rbegin(), tree.rend(), reference.rbegin(), reference.rend()));
+
+    SECTION("Lookup")
+    {
+        for(int i = 0; i < 300; i++)
+        {
+            int  p = std::rand() % 1100 - 50;
+            auto k = get_random_key(1100);
+
+            std::vector<value_type> expected, actual;
+            reference.at(p, [&](iterator it){ expected.push_back(*it); });
+            tree.at(p, [&](btree::iterator it){ actual.push_back(*it); });
+            REQUIRE(expected == actual);
+
+            expected.clear();
+            actual.clear();
+            reference.in(k, [&](iterator it){ expected.push_back(*it); });
+            for(auto it : tree.in(k))
+                actual.push_back(*it);
+            REQUIRE(expected == actual);
+
+            REQUIRE(tree.count(k) == reference.count(k));
+            REQUIRE(std::distance(tree.begin(), tree.lower_bound(k)) == std::distance(reference.begin(), reference.lower_bound(k)));
+            REQUIRE(std::distance(tree.begin(), tree.upper_bound(k)) == std::distance(reference.begin(), reference.upper_bound(k)));
+        }
+
+        auto k = std::next(reference.begin(), 1234)->first;
+        REQUIRE(tree.find(k) != tree.end());
+        REQUIRE(tree.find(k)->first == k);
+        REQUIRE(tree.find({-5, -4}) == tree.end());
+        REQUIRE_THROWS_AS(tree.in(3, 2), std::range_error);
+
+        std::size_t n = 0;
+        tree.in(0, 1000, [&](btree::iterator){ return ++n < 5; });
+        REQUIRE(n == 5);
+
+        n = 0;
+        tree.in(0, 1000, [&](btree::iterator){ return 5 - int(++n); });
+        REQUIRE(n == 5);
+    }
+
+    SECTION("Erase")
+    {
+        for(int i = 0; i < 4000; i++)
+        {
+            auto pos  = std::rand() % tree.size();
+            auto it   = tree.erase(std::next(tree.begin(), pos));
+            auto next = reference.erase(std::next(reference.begin(), pos));
+
+            REQUIRE(std::distance(tree.begin(), it) == std::distance(reference.begin(), next));
+
+            if(i % 500 == 0)
+                REQUIRE(tree.__check_invariants());
+        }
+
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+
+        for(int i = 0; i < 1000; i++)
+        {
+            auto k = get_random_key(1000);
+            reference.emplace(k, std::to_string(i));
+            tree.emplace(k, std::to_string(i));
+        }
+
+        REQUIRE(tree.__check_invariants());
+        REQUIRE(std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+
+        auto k = tree.begin()->first;
+        REQUIRE(tree.erase(k) == reference.erase(k));
+
+        auto it = tree.erase(std::next(tree.begin(), 100), std::next(tree.begin(), 1900));
+        REQUIRE(it == std::next(tree.begin(), 100));
+        REQUIRE(tree.__check_invariants());
+
+        tree.erase(tree.begin(), tree.end());
+        REQUIRE(tree.empty());
+        REQUIRE(tree.begin() == tree.end());
+        REQUIRE(tree.__check_invariants());
+    }
+
+    SECTION("Hint")
+    {
+        btree sorted;
+
+        for(auto& v : reference)
+            sorted.emplace_hint(sorted.end(), v);
+
+        REQUIRE(sorted == tree);
+        REQUIRE(sorted.__check_invariants());
+
+        auto hint = std::next(sorted.begin(), 2500);
+        sorted.emplace_hint(hint, key_type{-1, 0}, "misplaced");
+        REQUIRE(sorted.begin()->second == "misplaced");
+        REQUIRE(sorted.__check_invariants());
+
+        // the full leaves left by appending are split in half when something
+        // is added at their end, only the last one is split unevenly
+        std::vector<key_type> keys;
+        for(auto& v : reference)
+            keys.push_back(v.first);
+
+        for(auto k = keys.rbegin(); k != keys.rend(); ++k)
+        {
+            reference.emplace(*k, "again");
+            sorted.emplace(*k, "again");
+        }
+
+        REQUIRE(sorted.__check_invariants());
+        REQUIRE(std::equal(std::next(sorted.begin()), sorted.end(), reference.begin(), reference.end()));
+    }
+
+    SECTION("Copy and move")
+    {
+        btree copy(tree);
+        REQUIRE(copy == tree);
+        REQUIRE(copy.__check_invariants());
+
+        btree moved(std::move(copy));
+        REQUIRE(moved == tree);
+        REQUIRE(copy.empty());
+
+        copy = moved;
+        REQUIRE(copy == tree);
+
+        moved.clear();
+        REQUIRE(moved.empty());
+        REQUIRE(moved.__check_invariants());
+
+        swap(moved, copy);
+        REQUIRE(moved == tree);
+        REQUIRE(copy.empty());
+    }
+}
+
+
 
 int generate_size()
 {